@@ -0,0 +1,458 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+/*
+ * mfrHalBench: throughput and latency of the MFR HAL APIs.
+ *
+ * It links a copy of the library built with MFRLIB_ROOT_SUPPORT, which resolves every absolute
+ * path under MFRLIB_ROOT and reads the MAC addresses from files there instead of the host's
+ * interfaces and Bluetooth controller. Unless -d names an existing root, a fixture tree with
+ * device.properties, cpuinfo, version.txt, the addresses and a few thermal sensors is generated
+ * in a temporary directory, so the benchmark runs the same on any Linux machine.
+ */
+
+#define _GNU_SOURCE
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "mfrTypes.h"
+#include "mfrlibs_rpi.h"
+#include "mfrlib_root.h"
+#ifdef THERMAL_PROTECTION_ENABLED
+#include "mfr_temperature.h"
+#endif
+
+#define DEFAULT_ITERATIONS 2000
+#define DEFAULT_THREADS 4
+#define DEFAULT_CYCLES 200
+#define MAX_THREADS 64
+/* default of -l; make check sets it so that a build fails on a gross latency regression */
+#define MAX_P99_ENV "MFRHALBENCH_MAX_P99_US"
+
+typedef enum {
+    BENCH_SERIALIZED_DATA = 0,
+    BENCH_INIT_TERM,
+    BENCH_TEMPERATURE,
+    BENCH_TEMPERATURE_ZONES
+} benchOperation_t;
+
+/* Releases the threads of one run together, or tells them to quit if not all could be created */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int state;                  /* 0: wait, 1: run, -1: quit */
+} benchStart_t;
+
+typedef struct {
+    benchOperation_t operation;
+    mfrSerializedType_t type;
+    int iterations;
+    uint64_t *latencyNs;        /* one entry per iteration */
+    benchStart_t *start;
+    uint64_t beginNs;
+    uint64_t endNs;
+} benchThread_t;
+
+typedef struct {
+    char root[PATH_MAX];
+    int generated;
+    int iterations;
+    int threads;
+    int cycles;
+    double maxP99Us;            /* 0: no limit */
+    int failed;
+} benchConfig_t;
+
+/* Keep order matching with mfrSerializedType_t from mfrTypes.h */
+static const char *serializedTypeNames[] = {
+    "manufacturer", "manufactureroui", "modelname", "description", "productclass",
+    "serialnumber", "hardwareversion", "softwareversion", "provisioningcode", "firstusedate",
+    "devicemac", "mocamac", "hdmihdcp", "pdriversion", "wifimac",
+    "bluetoothmac", "wpspin", "manufacturingserialnumber", "ethernetmac", "estbmac",
+    "rf4cemac", "provisionedmodelname", "pmi", "hwid", "modelnumber",
+    "socid", "imagename", "imagetype", "blversion", "region",
+    "bdriversion", "ledwhitelevel", "ledpattern", NULL
+};
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int writeFixture(const char *root, const char *path, const char *content)
+{
+    char full[PATH_MAX];
+    char *slash = NULL;
+    FILE *file = NULL;
+
+    snprintf(full, sizeof(full), "%s%s", root, path);
+    /* create the parent directories */
+    for (slash = strchr(full + strlen(root) + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(full, 0755);
+        *slash = '/';
+    }
+    file = fopen(full, "w");
+    if (!file) {
+        perror(full);
+        return -1;
+    }
+    fputs(content, file);
+    fclose(file);
+    return 0;
+}
+
+/**
+ * @brief Generate a fixture root resembling an RPi4 running RDK
+ */
+static int generateFixtureRoot(benchConfig_t *config)
+{
+    static const struct {
+        const char *path;
+        const char *content;
+    } fixtures[] = {
+        { "/etc/device.properties",
+          "# fixture generated by mfrHalBench\n"
+          "MFG_NAME=Raspberry Pi Foundation\n"
+          "MODEL_NUM=RPI4\n"
+          "DEVICE_NAME=RPI4\n"
+          "FRIENDLY_ID=Raspberry Pi 4\n"
+          "BUILD_TYPE=dev\n"
+          "MOCA_INTERFACE=eth0\n"
+          "WIFI_INTERFACE=wlan0\n"
+          "ETHERNET_INTERFACE=eth0\n"
+          "DEFAULT_ESTB_INTERFACE=eth0\n" },
+        { "/proc/cpuinfo",
+          "processor\t: 0\nBogoMIPS\t: 108.00\nFeatures\t: fp asimd evtstrm crc32 cpuid\n"
+          "CPU implementer\t: 0x41\nCPU part\t: 0xd08\n\n"
+          "Hardware\t: BCM2835\nRevision\t: c03114\nSerial\t\t: 10000000abcdef01\n"
+          "Model\t\t: Raspberry Pi 4 Model B Rev 1.4\n" },
+        { "/version.txt",
+          "imagename:rdk-generic-mediaclient-image_default_20240101000000\n"
+          "BRANCH:develop\nVERSION:2.0\nSPIN:0\nBUILD_TIME:\"2024-01-01 00:00:00\"\n" },
+        { "/sys/class/net/eth0/address", "dc:a6:32:00:00:01\n" },
+        { "/sys/class/net/wlan0/address", "dc:a6:32:00:00:02\n" },
+        { "/sys/class/bluetooth/hci0/address", "dc:a6:32:00:00:03\n" },
+        { "/sys/class/thermal/thermal_zone0/type", "cpu-thermal\n" },
+        { "/sys/class/thermal/thermal_zone0/temp", "48250\n" },
+        { "/sys/class/thermal/thermal_zone1/type", "wifi-thermal\n" },
+        { "/sys/class/thermal/thermal_zone1/temp", "41000\n" },
+        /* the kernel names the hwmon mirror of cpu-thermal cpu_thermal; it must not be added twice */
+        { "/sys/class/hwmon/hwmon0/name", "cpu_thermal\n" },
+        { "/sys/class/hwmon/hwmon0/temp1_input", "48250\n" },
+        { "/sys/class/hwmon/hwmon2/name", "rpi_volt\n" },
+        { "/sys/class/hwmon/hwmon1/name", "pmic\n" },
+        { "/sys/class/hwmon/hwmon1/temp1_input", "45500\n" },
+    };
+    const char *tmp = getenv("TMPDIR");
+
+    snprintf(config->root, sizeof(config->root), "%s/mfrHalBench.XXXXXX", (tmp && *tmp) ? tmp : "/tmp");
+    if (!mkdtemp(config->root)) {
+        perror("mkdtemp");
+        return -1;
+    }
+    config->generated = 1;
+    for (size_t i = 0; i < sizeof(fixtures) / sizeof(fixtures[0]); i++) {
+        if (writeFixture(config->root, fixtures[i].path, fixtures[i].content) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int removeFixtureEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    if (remove(path) == -1) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static void removeFixtureRoot(const benchConfig_t *config)
+{
+    /* depth first, and symlinks are removed rather than followed */
+    if (config->generated && nftw(config->root, removeFixtureEntry, 16, FTW_DEPTH | FTW_PHYS) != 0) {
+        fprintf(stderr, "failed to remove '%s'\n", config->root);
+    }
+}
+
+#ifdef THERMAL_PROTECTION_ENABLED
+/* sensors of the generated fixture: cpu-thermal, wifi-thermal and pmic/temp1 */
+#define FIXTURE_SENSOR_COUNT 3
+
+/**
+ * @brief Check that the generated fixture yields each sensor once; cpu_thermal mirrors cpu-thermal
+ */
+static void checkFixtureSensors(benchConfig_t *config)
+{
+    mfrThermalZone_t zones[16];
+    int count = 0;
+
+    if (config->generated && (mfrGetTemperatureZones(zones, 16, &count) != mfrERR_NONE || count != FIXTURE_SENSOR_COUNT)) {
+        printf("fixture reports %d sensors, expected %d\n", count, FIXTURE_SENSOR_COUNT);
+        config->failed = 1;
+    }
+}
+#endif
+
+static void runOperation(const benchThread_t *bench)
+{
+    switch (bench->operation) {
+        case BENCH_SERIALIZED_DATA: {
+            mfrSerializedData_t data = {0};
+            if (mfrGetSerializedData(bench->type, &data) == mfrERR_NONE && data.freeBuf) {
+                data.freeBuf(data.buf);
+            }
+            break;
+        }
+        case BENCH_INIT_TERM:
+            mfr_init();
+            mfr_term();
+            break;
+#ifdef THERMAL_PROTECTION_ENABLED
+        case BENCH_TEMPERATURE: {
+            mfrTemperatureState_t state;
+            int temperature;
+            int wifiTemperature;
+            mfrGetTemperature(&state, &temperature, &wifiTemperature);
+            break;
+        }
+        case BENCH_TEMPERATURE_ZONES: {
+            mfrThermalZone_t zones[16];
+            int count;
+            mfrGetTemperatureZones(zones, 16, &count);
+            break;
+        }
+#endif
+        default:
+            break;
+    }
+}
+
+static void *benchThreadMain(void *arg)
+{
+    benchThread_t *bench = (benchThread_t *)arg;
+    int state;
+
+    pthread_mutex_lock(&bench->start->lock);
+    while ((state = bench->start->state) == 0) {
+        pthread_cond_wait(&bench->start->cond, &bench->start->lock);
+    }
+    pthread_mutex_unlock(&bench->start->lock);
+    if (state == -1) {
+        return NULL;
+    }
+    bench->beginNs = nowNs();
+    for (int i = 0; i < bench->iterations; i++) {
+        uint64_t start = nowNs();
+        runOperation(bench);
+        bench->latencyNs[i] = nowNs() - start;
+    }
+    bench->endNs = nowNs();
+    return NULL;
+}
+
+static int compareLatency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Run one operation on the given number of threads and print its line of results
+ */
+static void benchOperation(benchConfig_t *config, const char *name, benchOperation_t operation,
+                           mfrSerializedType_t type, int iterations, int threads)
+{
+    benchThread_t bench[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    benchStart_t start = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+    int created = 0;
+    uint64_t *latencyNs = NULL;
+    size_t total = (size_t)iterations * threads;
+    uint64_t begin = UINT64_MAX;
+    uint64_t end = 0;
+    double p50;
+    double p99;
+
+    latencyNs = (uint64_t *)malloc(total * sizeof(uint64_t));
+    if (!latencyNs) {
+        fprintf(stderr, "out of memory\n");
+        config->failed = 1;
+        return;
+    }
+
+    for (created = 0; created < threads; created++) {
+        bench[created].operation = operation;
+        bench[created].type = type;
+        bench[created].iterations = iterations;
+        bench[created].latencyNs = latencyNs + (size_t)created * iterations;
+        bench[created].start = &start;
+        if (pthread_create(&tids[created], NULL, benchThreadMain, &bench[created]) != 0) {
+            break;
+        }
+    }
+    pthread_mutex_lock(&start.lock);
+    start.state = (created == threads) ? 1 : -1;
+    pthread_cond_broadcast(&start.cond);
+    pthread_mutex_unlock(&start.lock);
+    for (int i = 0; i < created; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    if (created != threads) {
+        fprintf(stderr, "%s: failed to create thread %d of %d\n", name, created + 1, threads);
+        config->failed = 1;
+        free(latencyNs);
+        return;
+    }
+    for (int i = 0; i < threads; i++) {
+        begin = (bench[i].beginNs < begin) ? bench[i].beginNs : begin;
+        end = (bench[i].endNs > end) ? bench[i].endNs : end;
+    }
+
+    qsort(latencyNs, total, sizeof(uint64_t), compareLatency);
+    p50 = latencyNs[total / 2] / 1000.0;
+    p99 = latencyNs[(total * 99) / 100] / 1000.0;
+    printf("%-34s %7d %12.0f %10.2f %10.2f %10.2f\n", name, threads,
+           total / ((end - begin) / 1e9), p50, p99, latencyNs[total - 1] / 1000.0);
+    if (config->maxP99Us > 0 && p99 > config->maxP99Us) {
+        printf("  ^ p99 %.2fus exceeds the %.2fus limit\n", p99, config->maxP99Us);
+        config->failed = 1;
+    }
+    free(latencyNs);
+}
+
+static void benchAll(benchConfig_t *config, int threads)
+{
+    mfr_init();
+    for (mfrSerializedType_t type = mfrSERIALIZED_TYPE_MANUFACTURER; serializedTypeNames[type]; type++) {
+        benchOperation(config, serializedTypeNames[type], BENCH_SERIALIZED_DATA, type, config->iterations, threads);
+    }
+#ifdef THERMAL_PROTECTION_ENABLED
+    benchOperation(config, "mfrGetTemperature", BENCH_TEMPERATURE, 0, config->iterations, threads);
+    benchOperation(config, "mfrGetTemperatureZones", BENCH_TEMPERATURE_ZONES, 0, config->iterations, threads);
+    if (mfrStartTempSampler(1000) == mfrERR_NONE) {
+        benchOperation(config, "mfrGetTemperature (sampler)", BENCH_TEMPERATURE, 0, config->iterations, threads);
+        benchOperation(config, "mfrGetTemperatureZones (sampler)", BENCH_TEMPERATURE_ZONES, 0, config->iterations, threads);
+        mfrStopTempSampler();
+    }
+#endif
+    mfr_term();
+
+    /* init/term are serialized by the library, so a single thread measures them */
+    if (threads == 1) {
+        benchOperation(config, "mfr_init+mfr_term", BENCH_INIT_TERM, 0, config->cycles, 1);
+    }
+}
+
+static void showUsage(const char *progName)
+{
+    printf("Usage: %s [-d rootDir] [-n iterations] [-t threads] [-c cycles] [-l maxP99Us] [-k]\n"
+           "\t-d rootDir: existing root to resolve the library paths under; a fixture root\n"
+           "\t            is generated in $TMPDIR when not given\n"
+           "\t-n iterations: calls per operation and thread (default %d)\n"
+           "\t-t threads: threads of the concurrent run (default %d)\n"
+           "\t-c cycles: mfr_init/mfr_term cycles (default %d)\n"
+           "\t-l maxP99Us: exit with an error if any p99 latency exceeds this many microseconds;\n"
+           "\t            defaults to $%s, no limit when unset\n"
+           "\t-k: keep the generated fixture root\n",
+           progName, DEFAULT_ITERATIONS, DEFAULT_THREADS, DEFAULT_CYCLES, MAX_P99_ENV);
+}
+
+int main(int argc, char **argv)
+{
+    benchConfig_t config = { .iterations = DEFAULT_ITERATIONS, .threads = DEFAULT_THREADS, .cycles = DEFAULT_CYCLES };
+    const char *maxP99 = getenv(MAX_P99_ENV);
+    int keep = 0;
+    int c;
+
+    if (maxP99 && *maxP99) {
+        config.maxP99Us = atof(maxP99);
+    }
+
+    while ((c = getopt(argc, argv, "d:n:t:c:l:kh")) != -1) {
+        switch (c) {
+            case 'd':
+                snprintf(config.root, sizeof(config.root), "%s", optarg);
+                break;
+            case 'n':
+                config.iterations = atoi(optarg);
+                break;
+            case 't':
+                config.threads = atoi(optarg);
+                break;
+            case 'c':
+                config.cycles = atoi(optarg);
+                break;
+            case 'l':
+                config.maxP99Us = atof(optarg);
+                break;
+            case 'k':
+                keep = 1;
+                break;
+            default:
+                showUsage(argv[0]);
+                return -1;
+        }
+    }
+    if (config.iterations <= 0 || config.cycles <= 0 || config.threads <= 0 || config.threads > MAX_THREADS) {
+        showUsage(argv[0]);
+        return -1;
+    }
+
+    if (config.root[0] == '\0' && generateFixtureRoot(&config) == -1) {
+        removeFixtureRoot(&config);
+        return -1;
+    }
+    /* must be set before the first library call; the root is read once */
+    setenv(MFRLIB_ROOT_ENV, config.root, 1);
+    printf("root: %s\n", config.root);
+
+#ifdef THERMAL_PROTECTION_ENABLED
+    checkFixtureSensors(&config);
+#endif
+    printf("%-34s %7s %12s %10s %10s %10s\n", "operation", "threads", "ops/s", "p50(us)", "p99(us)", "max(us)");
+    benchAll(&config, 1);
+    if (config.threads > 1) {
+        printf("\n");
+        benchAll(&config, config.threads);
+    }
+
+    if (!keep) {
+        removeFixtureRoot(&config);
+    }
+    return config.failed ? 1 : 0;
+}
@@ -0,0 +1,590 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+
+#include "mfrlib_copy.h"
+#include "mfrlib_logger.h"
+
+#define COPY_MAX_THREADS 8
+#define COPY_CHUNK_SIZE (8 * 1024 * 1024)
+#define COPY_BUF_SIZE (64 * 1024)
+#define COPY_XATTR_LIST_SIZE 4096
+#define COPY_XATTR_VALUE_SIZE 65536
+#define COPY_LINK_BUCKETS 1024
+#define COPY_IDLE_NS 200000             /* idle workers poll the other deques this often */
+
+/* Directory still to be copied, as a path relative to both roots ("" for the roots) */
+typedef struct {
+    pthread_mutex_t lock;
+    char **tasks;
+    size_t top;                 /* thieves take from here, oldest first */
+    size_t bottom;              /* the owner pushes and pops here */
+    size_t capacity;
+} copyDeque_t;
+
+/* First copy of a file with several links; later links to the same inode are linked to it */
+typedef struct copyLink {
+    struct copyLink *next;
+    dev_t dev;
+    ino_t ino;
+    char path[];                /* relative to the destination root */
+} copyLink_t;
+
+/* Directory modes and times are applied once everything below them is written */
+typedef struct {
+    char *path;
+    mode_t mode;
+    struct timespec times[2];
+} copyDirAttrs_t;
+
+typedef struct {
+    int srcRoot;
+    int dstRoot;
+    const char *srcPath;
+    const char *dstPath;
+    int threads;
+    copyDeque_t *deques;
+    _Atomic size_t pending;     /* directories queued or being copied */
+    atomic_int failed;
+
+    pthread_mutex_t linkLock;
+    copyLink_t *links[COPY_LINK_BUCKETS];
+
+    pthread_mutex_t dirLock;
+    copyDirAttrs_t *dirs;
+    size_t dirCount;
+    size_t dirCapacity;
+} copyEngine_t;
+
+typedef struct {
+    copyEngine_t *engine;
+    int id;
+    pthread_t thread;
+    char *xattrList;
+    char *xattrValue;
+} copyWorker_t;
+
+static int dequePush(copyDeque_t *deque, char *task)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom == deque->capacity) {
+        if (deque->top > 0) {
+            memmove(deque->tasks, deque->tasks + deque->top, (deque->bottom - deque->top) * sizeof(char *));
+            deque->bottom -= deque->top;
+            deque->top = 0;
+        } else {
+            size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+            char **tasks = realloc(deque->tasks, capacity * sizeof(char *));
+            if (!tasks) {
+                ret = -1;
+                goto out;
+            }
+            deque->tasks = tasks;
+            deque->capacity = capacity;
+        }
+    }
+    deque->tasks[deque->bottom++] = task;
+
+out:
+    pthread_mutex_unlock(&deque->lock);
+    return ret;
+}
+
+static char *dequeTake(copyDeque_t *deque, int steal)
+{
+    char *task = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom) {
+        task = steal ? deque->tasks[deque->top++] : deque->tasks[--deque->bottom];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+static void copyFailed(copyEngine_t *engine, const char *what, const char *dir, const char *name)
+{
+    mfrlib_log("copyTree %s '%s%s%s' failed: %s\n", what, dir, (dir[0] && name[0]) ? "/" : "", name, strerror(errno));
+    atomic_store(&engine->failed, 1);
+}
+
+static int queueDirectory(copyEngine_t *engine, copyWorker_t *worker, const char *dir, const char *name)
+{
+    char *task = malloc(strlen(dir) + strlen(name) + 2);
+
+    if (!task) {
+        return -1;
+    }
+    sprintf(task, "%s%s%s", dir, dir[0] ? "/" : "", name);
+    atomic_fetch_add(&engine->pending, 1);
+    if (dequePush(&engine->deques[worker->id], task) == -1) {
+        atomic_fetch_sub(&engine->pending, 1);
+        free(task);
+        return -1;
+    }
+    return 0;
+}
+
+static int recordDirectory(copyEngine_t *engine, const char *dir, const char *name, const struct stat *st)
+{
+    copyDirAttrs_t *attrs;
+    int ret = 0;
+
+    pthread_mutex_lock(&engine->dirLock);
+    if (engine->dirCount == engine->dirCapacity) {
+        size_t capacity = engine->dirCapacity ? engine->dirCapacity * 2 : 256;
+        copyDirAttrs_t *dirs = realloc(engine->dirs, capacity * sizeof(copyDirAttrs_t));
+        if (!dirs) {
+            ret = -1;
+            goto out;
+        }
+        engine->dirs = dirs;
+        engine->dirCapacity = capacity;
+    }
+    attrs = &engine->dirs[engine->dirCount];
+    attrs->path = malloc(strlen(dir) + strlen(name) + 2);
+    if (!attrs->path) {
+        ret = -1;
+        goto out;
+    }
+    sprintf(attrs->path, "%s%s%s", dir, dir[0] ? "/" : "", name);
+    attrs->mode = st->st_mode & 07777;
+    attrs->times[0] = st->st_atim;
+    attrs->times[1] = st->st_mtim;
+    engine->dirCount++;
+
+out:
+    pthread_mutex_unlock(&engine->dirLock);
+    return ret;
+}
+
+/**
+ * @brief Copy the extended attributes of an entry; by descriptor when both fds are given
+ */
+static int copyXattrs(copyWorker_t *worker, int srcFd, int dstFd, const char *srcPath, const char *dstPath)
+{
+    ssize_t listLen = (srcFd != -1) ? flistxattr(srcFd, worker->xattrList, COPY_XATTR_LIST_SIZE)
+                                    : llistxattr(srcPath, worker->xattrList, COPY_XATTR_LIST_SIZE);
+
+    if (listLen < 0) {
+        return (errno == ENOTSUP) ? 0 : -1;
+    }
+    for (char *name = worker->xattrList; name < worker->xattrList + listLen; name += strlen(name) + 1) {
+        ssize_t len = (srcFd != -1) ? fgetxattr(srcFd, name, worker->xattrValue, COPY_XATTR_VALUE_SIZE)
+                                    : lgetxattr(srcPath, name, worker->xattrValue, COPY_XATTR_VALUE_SIZE);
+        if (len < 0) {
+            return -1;
+        }
+        /* as with cp -a, attributes the destination does not support are dropped */
+        if (((dstFd != -1) ? fsetxattr(dstFd, name, worker->xattrValue, (size_t)len, 0)
+                           : lsetxattr(dstPath, name, worker->xattrValue, (size_t)len, 0)) == -1 &&
+            errno != ENOTSUP) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int copyFileData(int srcFd, int dstFd, off_t size)
+{
+    char buf[COPY_BUF_SIZE];
+    off_t done = 0;
+    ssize_t len = 0;
+
+    /* in the kernel first; copy_file_range is refused across some filesystems, sendfile is not */
+    while (done < size && (len = copy_file_range(srcFd, NULL, dstFd, NULL, COPY_CHUNK_SIZE, 0)) > 0) {
+        done += len;
+    }
+    if (done < size && done == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+        while (done < size && (len = sendfile(dstFd, srcFd, NULL, COPY_CHUNK_SIZE)) > 0) {
+            done += len;
+        }
+        if (done == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            while ((len = read(srcFd, buf, sizeof(buf))) > 0) {
+                for (ssize_t written = 0, n; written < len; written += n) {
+                    if ((n = write(dstFd, buf + written, (size_t)(len - written))) < 0) {
+                        return -1;
+                    }
+                }
+                done += len;
+            }
+        }
+    }
+    /* the file may have changed size under us; take what was there */
+    return (len < 0) ? -1 : 0;
+}
+
+/**
+ * @brief If the entry has other links already copied, link to that copy
+ * @return 1 when linked, 0 when this is the first copy and was created as dstFd, -1 on failure
+ */
+static int linkOrCreate(copyEngine_t *engine, int dstDirFd, const char *dir, const char *name,
+                        const struct stat *st, int *dstFd)
+{
+    size_t bucket = (size_t)(st->st_ino ^ st->st_dev) % COPY_LINK_BUCKETS;
+    copyLink_t *link;
+    int ret = 0;
+
+    *dstFd = -1;
+    pthread_mutex_lock(&engine->linkLock);
+    for (link = engine->links[bucket]; link; link = link->next) {
+        if (link->ino == st->st_ino && link->dev == st->st_dev) {
+            break;
+        }
+    }
+    if (link) {
+        ret = (linkat(engine->dstRoot, link->path, dstDirFd, name, 0) == 0) ? 1 : -1;
+    } else if ((link = malloc(sizeof(copyLink_t) + strlen(dir) + strlen(name) + 2)) != NULL) {
+        /* created under the lock, so a racing link to the same inode finds the file */
+        *dstFd = openat(dstDirFd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+        if (*dstFd == -1) {
+            free(link);
+            ret = -1;
+        } else {
+            link->dev = st->st_dev;
+            link->ino = st->st_ino;
+            sprintf(link->path, "%s%s%s", dir, dir[0] ? "/" : "", name);
+            link->next = engine->links[bucket];
+            engine->links[bucket] = link;
+        }
+    } else {
+        ret = -1;
+    }
+    pthread_mutex_unlock(&engine->linkLock);
+    return ret;
+}
+
+static int copyRegular(copyWorker_t *worker, int srcDirFd, int dstDirFd, const char *dir, const char *name,
+                       const struct stat *st)
+{
+    copyEngine_t *engine = worker->engine;
+    struct timespec times[2] = { st->st_atim, st->st_mtim };
+    int srcFd;
+    int dstFd = -1;
+    int ret = -1;
+
+    if (st->st_nlink > 1) {
+        int linked = linkOrCreate(engine, dstDirFd, dir, name, st, &dstFd);
+        if (linked != 0) {
+            return (linked == 1) ? 0 : -1;
+        }
+    } else {
+        dstFd = openat(dstDirFd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+    }
+    srcFd = openat(srcDirFd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (srcFd == -1 || dstFd == -1) {
+        goto out;
+    }
+
+    /* owner before mode, which chown may clear setuid from; xattrs after, chown drops capabilities */
+    if (copyFileData(srcFd, dstFd, st->st_size) == -1 ||
+        fchown(dstFd, st->st_uid, st->st_gid) == -1 ||
+        fchmod(dstFd, st->st_mode & 07777) == -1 ||
+        copyXattrs(worker, srcFd, dstFd, NULL, NULL) == -1 ||
+        futimens(dstFd, times) == -1) {
+        goto out;
+    }
+    ret = 0;
+
+out:
+    if (srcFd != -1) {
+        close(srcFd);
+    }
+    if (dstFd != -1) {
+        close(dstFd);
+    }
+    return ret;
+}
+
+/**
+ * @brief Copy a symlink, device node, fifo or socket
+ */
+static int copySpecial(copyWorker_t *worker, int srcDirFd, int dstDirFd, const char *dir, const char *name,
+                       const struct stat *st)
+{
+    copyEngine_t *engine = worker->engine;
+    struct timespec times[2] = { st->st_atim, st->st_mtim };
+    char srcPath[PATH_MAX];
+    char dstPath[PATH_MAX];
+    char target[PATH_MAX];
+    ssize_t len;
+
+    unlinkat(dstDirFd, name, 0);
+    if (S_ISLNK(st->st_mode)) {
+        if ((len = readlinkat(srcDirFd, name, target, sizeof(target) - 1)) < 0) {
+            return -1;
+        }
+        target[len] = '\0';
+        if (symlinkat(target, dstDirFd, name) == -1) {
+            return -1;
+        }
+    } else if (mknodat(dstDirFd, name, st->st_mode & (S_IFMT | 07777), st->st_rdev) == -1) {
+        return -1;
+    }
+
+    if (fchownat(dstDirFd, name, st->st_uid, st->st_gid, AT_SYMLINK_NOFOLLOW) == -1 ||
+        (!S_ISLNK(st->st_mode) && fchmodat(dstDirFd, name, st->st_mode & 07777, 0) == -1)) {
+        return -1;
+    }
+    snprintf(srcPath, sizeof(srcPath), "%s/%s%s%s", engine->srcPath, dir, dir[0] ? "/" : "", name);
+    snprintf(dstPath, sizeof(dstPath), "%s/%s%s%s", engine->dstPath, dir, dir[0] ? "/" : "", name);
+    if (copyXattrs(worker, -1, -1, srcPath, dstPath) == -1 && errno != EPERM) {
+        return -1;
+    }
+    return utimensat(dstDirFd, name, times, AT_SYMLINK_NOFOLLOW);
+}
+
+static int copySubdirectory(copyWorker_t *worker, int srcDirFd, int dstDirFd, const char *dir, const char *name,
+                            const struct stat *st)
+{
+    copyEngine_t *engine = worker->engine;
+    int srcFd;
+    int dstFd;
+    int ret = -1;
+
+    if (mkdirat(dstDirFd, name, 0700) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    srcFd = openat(srcDirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    dstFd = openat(dstDirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    if (srcFd != -1 && dstFd != -1 &&
+        fchown(dstFd, st->st_uid, st->st_gid) == 0 &&
+        copyXattrs(worker, srcFd, dstFd, NULL, NULL) == 0 &&
+        recordDirectory(engine, dir, name, st) == 0 &&
+        queueDirectory(engine, worker, dir, name) == 0) {
+        ret = 0;
+    }
+    if (srcFd != -1) {
+        close(srcFd);
+    }
+    if (dstFd != -1) {
+        close(dstFd);
+    }
+    return ret;
+}
+
+static void copyDirectory(copyWorker_t *worker, const char *dir)
+{
+    copyEngine_t *engine = worker->engine;
+    int srcDirFd = dir[0] ? openat(engine->srcRoot, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW)
+                          : dup(engine->srcRoot);
+    int dstDirFd = dir[0] ? openat(engine->dstRoot, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW)
+                          : dup(engine->dstRoot);
+    DIR *entries = (srcDirFd != -1) ? fdopendir(dup(srcDirFd)) : NULL;
+    struct dirent *entry;
+
+    if (!entries || dstDirFd == -1) {
+        copyFailed(engine, "open", dir, "");
+        goto out;
+    }
+    rewinddir(entries);
+    while (!atomic_load_explicit(&engine->failed, memory_order_relaxed) && (entry = readdir(entries)) != NULL) {
+        struct stat st;
+        int ret;
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (fstatat(srcDirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            copyFailed(engine, "stat", dir, entry->d_name);
+            break;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            ret = copySubdirectory(worker, srcDirFd, dstDirFd, dir, entry->d_name, &st);
+        } else if (S_ISREG(st.st_mode)) {
+            ret = copyRegular(worker, srcDirFd, dstDirFd, dir, entry->d_name, &st);
+        } else {
+            ret = copySpecial(worker, srcDirFd, dstDirFd, dir, entry->d_name, &st);
+        }
+        if (ret == -1) {
+            copyFailed(engine, "copy", dir, entry->d_name);
+        }
+    }
+
+out:
+    if (entries) {
+        closedir(entries);
+    }
+    if (srcDirFd != -1) {
+        close(srcDirFd);
+    }
+    if (dstDirFd != -1) {
+        close(dstDirFd);
+    }
+}
+
+static void *copyWorkerMain(void *arg)
+{
+    copyWorker_t *worker = (copyWorker_t *)arg;
+    copyEngine_t *engine = worker->engine;
+    const struct timespec idle = { 0, COPY_IDLE_NS };
+
+    for (;;) {
+        char *dir = dequeTake(&engine->deques[worker->id], 0);
+
+        /* own work first, newest first for locality; otherwise steal the oldest from another */
+        for (int i = 1; !dir && i < engine->threads; i++) {
+            dir = dequeTake(&engine->deques[(worker->id + i) % engine->threads], 1);
+        }
+        if (!dir) {
+            if (atomic_load(&engine->pending) == 0) {
+                break;
+            }
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        if (!atomic_load_explicit(&engine->failed, memory_order_relaxed)) {
+            copyDirectory(worker, dir);
+        }
+        free(dir);
+        atomic_fetch_sub(&engine->pending, 1);
+    }
+    return NULL;
+}
+
+static int startWorkers(copyEngine_t *engine, copyWorker_t *workers)
+{
+    int started = 0;
+
+    for (int i = 0; i < engine->threads; i++) {
+        workers[i].engine = engine;
+        workers[i].id = i;
+        workers[i].xattrList = malloc(COPY_XATTR_LIST_SIZE);
+        workers[i].xattrValue = malloc(COPY_XATTR_VALUE_SIZE);
+        if (!workers[i].xattrList || !workers[i].xattrValue) {
+            break;
+        }
+    }
+    for (int i = 0; i < engine->threads; i++) {
+        if (!workers[i].xattrList || !workers[i].xattrValue ||
+            pthread_create(&workers[i].thread, NULL, copyWorkerMain, &workers[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    return started;
+}
+
+int copyTree(const char *src, const char *dst, int threads)
+{
+    copyEngine_t engine;
+    copyWorker_t workers[COPY_MAX_THREADS];
+    char *root = strdup("");
+    int started;
+    int ret;
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (int)cpus : 1;
+    }
+    threads = (threads > COPY_MAX_THREADS) ? COPY_MAX_THREADS : threads;
+
+    memset(&engine, 0, sizeof(engine));
+    memset(workers, 0, sizeof(workers));
+    engine.srcPath = src;
+    engine.dstPath = dst;
+    engine.threads = threads;
+    engine.srcRoot = open(src, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    engine.dstRoot = open(dst, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    engine.deques = calloc((size_t)threads, sizeof(copyDeque_t));
+    pthread_mutex_init(&engine.linkLock, NULL);
+    pthread_mutex_init(&engine.dirLock, NULL);
+    for (int i = 0; engine.deques && i < threads; i++) {
+        pthread_mutex_init(&engine.deques[i].lock, NULL);
+    }
+
+    ret = -1;
+    if (engine.srcRoot != -1 && engine.dstRoot != -1 && engine.deques && root) {
+        atomic_store(&engine.pending, 1);
+        dequePush(&engine.deques[0], root);
+        root = NULL;
+        started = startWorkers(&engine, workers);
+        if (started == 0 && workers[0].xattrList && workers[0].xattrValue) {
+            /* no thread could be started; do the walk here */
+            copyWorkerMain(&workers[0]);
+        } else if (started == 0) {
+            atomic_store(&engine.failed, 1);
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i].thread, NULL);
+        }
+
+        /* deepest last is not needed: setting the times of a directory leaves its parent alone */
+        for (size_t i = 0; i < engine.dirCount && !atomic_load(&engine.failed); i++) {
+            if (fchmodat(engine.dstRoot, engine.dirs[i].path, engine.dirs[i].mode, 0) == -1 ||
+                utimensat(engine.dstRoot, engine.dirs[i].path, engine.dirs[i].times, AT_SYMLINK_NOFOLLOW) == -1) {
+                copyFailed(&engine, "set attributes of", engine.dirs[i].path, "");
+            }
+        }
+        ret = atomic_load(&engine.failed) ? -1 : 0;
+    }
+
+    free(root);
+    for (int i = 0; i < COPY_MAX_THREADS; i++) {
+        free(workers[i].xattrList);
+        free(workers[i].xattrValue);
+    }
+    for (int i = 0; engine.deques && i < threads; i++) {
+        for (size_t j = engine.deques[i].top; j < engine.deques[i].bottom; j++) {
+            free(engine.deques[i].tasks[j]);
+        }
+        free(engine.deques[i].tasks);
+        pthread_mutex_destroy(&engine.deques[i].lock);
+    }
+    free(engine.deques);
+    for (int i = 0; i < COPY_LINK_BUCKETS; i++) {
+        while (engine.links[i]) {
+            copyLink_t *next = engine.links[i]->next;
+            free(engine.links[i]);
+            engine.links[i] = next;
+        }
+    }
+    for (size_t i = 0; i < engine.dirCount; i++) {
+        free(engine.dirs[i].path);
+    }
+    free(engine.dirs);
+    pthread_mutex_destroy(&engine.linkLock);
+    pthread_mutex_destroy(&engine.dirLock);
+    if (engine.srcRoot != -1) {
+        close(engine.srcRoot);
+    }
+    if (engine.dstRoot != -1) {
+        close(engine.dstRoot);
+    }
+    return ret;
+}
@@ -0,0 +1,35 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef MFRLIB_COPY_H
+#define MFRLIB_COPY_H
+
+/**
+ * @brief Copy the contents of a directory tree into an existing directory, as cp -a does
+ * @param src source directory
+ * @param dst destination directory; its own attributes are left alone
+ * @param threads number of copying threads; 0 uses one per online CPU, up to 8
+ * @return 0 on success, -1 on failure
+ * @info Directories are spread over the threads with work stealing. File data is copied in
+ *       the kernel (copy_file_range, else sendfile). Ownership, modes, timestamps, extended
+ *       attributes, symlinks, device nodes and hardlinks are preserved.
+ */
+int copyTree(const char *src, const char *dst, int threads);
+
+#endif /* MFRLIB_COPY_H */
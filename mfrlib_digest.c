@@ -0,0 +1,348 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+#include "mfrlib_digest.h"
+
+#define DIGEST_PIPE_SLOTS 8             /* 2MB in flight between the reader and the hasher */
+#define DIGEST_FILE_BUFFER_SIZE (1024 * 1024)
+#define DIGEST_FILE_ALIGNMENT 4096
+
+/*
+ * Slots are used in order. head counts the slots submitted by the reader, tail those the
+ * hasher is done with; the reader may fill slot head once head - tail < DIGEST_PIPE_SLOTS.
+ * A submitted length of 0 ends the stream. The mutex and condition are only used to sleep
+ * when a side has to wait; the sleeping flags tell the other side to wake it.
+ */
+struct digestPipe {
+    unsigned char *buf[DIGEST_PIPE_SLOTS];
+    size_t len[DIGEST_PIPE_SLOTS];
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    atomic_int readerSleeping;
+    atomic_int hasherSleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int threaded;
+    int failed;
+    EVP_MD_CTX *md5;
+    EVP_MD_CTX *sha256;
+};
+
+static void wakeSide(digestPipe_t *pipe, atomic_int *sleeping)
+{
+    if (atomic_load(sleeping)) {
+        pthread_mutex_lock(&pipe->lock);
+        pthread_cond_broadcast(&pipe->cond);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+}
+
+static void hashBuffer(digestPipe_t *pipe, const unsigned char *buf, size_t len)
+{
+    if (EVP_DigestUpdate(pipe->md5, buf, len) != 1 ||
+        (pipe->sha256 && EVP_DigestUpdate(pipe->sha256, buf, len) != 1)) {
+        pipe->failed = 1;
+    }
+}
+
+static void *hasherThreadMain(void *arg)
+{
+    digestPipe_t *pipe = (digestPipe_t *)arg;
+
+    for (;;) {
+        size_t tail = atomic_load_explicit(&pipe->tail, memory_order_relaxed);
+        size_t slot = tail % DIGEST_PIPE_SLOTS;
+        size_t len;
+
+        if (atomic_load_explicit(&pipe->head, memory_order_acquire) == tail) {
+            /* announce the sleep, then check again so a racing submit is never missed */
+            pthread_mutex_lock(&pipe->lock);
+            atomic_store(&pipe->hasherSleeping, 1);
+            while (atomic_load(&pipe->head) == tail) {
+                pthread_cond_wait(&pipe->cond, &pipe->lock);
+            }
+            atomic_store(&pipe->hasherSleeping, 0);
+            pthread_mutex_unlock(&pipe->lock);
+        }
+
+        len = pipe->len[slot];
+        if (len > 0) {
+            hashBuffer(pipe, pipe->buf[slot], len);
+        }
+        /* sequentially consistent, so it is ordered before the readerSleeping check */
+        atomic_store(&pipe->tail, tail + 1);
+        wakeSide(pipe, &pipe->readerSleeping);
+        if (len == 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void releasePipe(digestPipe_t *pipe)
+{
+    for (int i = 0; i < DIGEST_PIPE_SLOTS; i++) {
+        free(pipe->buf[i]);
+    }
+    EVP_MD_CTX_free(pipe->md5);
+    EVP_MD_CTX_free(pipe->sha256);
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->lock);
+    free(pipe);
+}
+
+digestPipe_t *digestPipeStart(int sha256)
+{
+    digestPipe_t *pipe = calloc(1, sizeof(*pipe));
+
+    if (!pipe) {
+        return NULL;
+    }
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+    for (int i = 0; i < DIGEST_PIPE_SLOTS; i++) {
+        if (!(pipe->buf[i] = malloc(DIGEST_PIPE_BUFFER_SIZE))) {
+            releasePipe(pipe);
+            return NULL;
+        }
+    }
+    pipe->md5 = EVP_MD_CTX_new();
+    pipe->sha256 = sha256 ? EVP_MD_CTX_new() : NULL;
+    if (!pipe->md5 || EVP_DigestInit_ex(pipe->md5, EVP_md5(), NULL) != 1 ||
+        (sha256 && (!pipe->sha256 || EVP_DigestInit_ex(pipe->sha256, EVP_sha256(), NULL) != 1))) {
+        releasePipe(pipe);
+        return NULL;
+    }
+    pipe->threaded = (pthread_create(&pipe->thread, NULL, hasherThreadMain, pipe) == 0);
+    return pipe;
+}
+
+unsigned char *digestPipeAcquire(digestPipe_t *pipe)
+{
+    size_t head = atomic_load_explicit(&pipe->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&pipe->tail, memory_order_acquire) == DIGEST_PIPE_SLOTS) {
+        pthread_mutex_lock(&pipe->lock);
+        atomic_store(&pipe->readerSleeping, 1);
+        while (head - atomic_load(&pipe->tail) == DIGEST_PIPE_SLOTS) {
+            pthread_cond_wait(&pipe->cond, &pipe->lock);
+        }
+        atomic_store(&pipe->readerSleeping, 0);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+    return pipe->buf[head % DIGEST_PIPE_SLOTS];
+}
+
+void digestPipeSubmit(digestPipe_t *pipe, size_t len)
+{
+    size_t head = atomic_load_explicit(&pipe->head, memory_order_relaxed);
+
+    if (!pipe->threaded) {
+        if (len > 0) {
+            hashBuffer(pipe, pipe->buf[head % DIGEST_PIPE_SLOTS], len);
+        }
+        return;
+    }
+    pipe->len[head % DIGEST_PIPE_SLOTS] = len;
+    atomic_store(&pipe->head, head + 1);
+    wakeSide(pipe, &pipe->hasherSleeping);
+}
+
+static void toHex(const unsigned char *digest, unsigned int len, char *hex)
+{
+    for (unsigned int i = 0; i < len; i++) {
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+    }
+    hex[2 * len] = '\0';
+}
+
+static int finishCopy(const EVP_MD_CTX *ctx, char *hex)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    EVP_MD_CTX *copy = EVP_MD_CTX_new();
+    int ret = -1;
+
+    if (copy && EVP_MD_CTX_copy_ex(copy, ctx) == 1 && EVP_DigestFinal_ex(copy, digest, &len) == 1) {
+        toHex(digest, len, hex);
+        ret = 0;
+    }
+    EVP_MD_CTX_free(copy);
+    return ret;
+}
+
+int digestPipeSnapshot(digestPipe_t *pipe, digestResult_t *result)
+{
+    size_t head = atomic_load_explicit(&pipe->head, memory_order_relaxed);
+
+    if (pipe->threaded && atomic_load_explicit(&pipe->tail, memory_order_acquire) != head) {
+        pthread_mutex_lock(&pipe->lock);
+        atomic_store(&pipe->readerSleeping, 1);
+        while (atomic_load(&pipe->tail) != head) {
+            pthread_cond_wait(&pipe->cond, &pipe->lock);
+        }
+        atomic_store(&pipe->readerSleeping, 0);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+
+    /* the hasher waits for the next submit, so its contexts can be copied */
+    memset(result, 0, sizeof(*result));
+    if (pipe->failed || finishCopy(pipe->md5, result->md5) == -1 ||
+        (pipe->sha256 && finishCopy(pipe->sha256, result->sha256) == -1)) {
+        return -1;
+    }
+    return 0;
+}
+
+int digestPipeFinish(digestPipe_t *pipe, digestResult_t *result)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    int ret = 0;
+
+    if (pipe->threaded) {
+        digestPipeAcquire(pipe);
+        digestPipeSubmit(pipe, 0);
+        pthread_join(pipe->thread, NULL);
+    }
+
+    if (result) {
+        memset(result, 0, sizeof(*result));
+        if (pipe->failed || EVP_DigestFinal_ex(pipe->md5, digest, &len) != 1) {
+            ret = -1;
+        } else {
+            toHex(digest, len, result->md5);
+        }
+        if (pipe->sha256) {
+            if (pipe->failed || EVP_DigestFinal_ex(pipe->sha256, digest, &len) != 1) {
+                ret = -1;
+            } else {
+                toHex(digest, len, result->sha256);
+            }
+        }
+    }
+    releasePipe(pipe);
+    return ret;
+}
+
+int digestMd5(const unsigned char *buf, size_t len, char *hex)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLen;
+
+    if (EVP_Digest(buf, len, digest, &digestLen, EVP_md5(), NULL) != 1) {
+        return -1;
+    }
+    toHex(digest, digestLen, hex);
+    return 0;
+}
+
+static int digestFile(int fd, uint64_t offset, uint64_t size, const EVP_MD *type, char *hex)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLen;
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    void *buf = NULL;
+    int ret = -1;
+
+    if (!ctx || EVP_DigestInit_ex(ctx, type, NULL) != 1 ||
+        posix_memalign(&buf, DIGEST_FILE_ALIGNMENT, DIGEST_FILE_BUFFER_SIZE) != 0) {
+        EVP_MD_CTX_free(ctx);
+        return -1;
+    }
+    while (size > 0) {
+        size_t len = (size < DIGEST_FILE_BUFFER_SIZE) ? (size_t)size : DIGEST_FILE_BUFFER_SIZE;
+        ssize_t n = pread(fd, buf, len, (off_t)offset);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || EVP_DigestUpdate(ctx, buf, (size_t)n) != 1) {
+            goto out;
+        }
+        offset += (uint64_t)n;
+        size -= (uint64_t)n;
+    }
+    if (EVP_DigestFinal_ex(ctx, digest, &digestLen) == 1) {
+        toHex(digest, digestLen, hex);
+        ret = 0;
+    }
+
+out:
+    free(buf);
+    EVP_MD_CTX_free(ctx);
+    return ret;
+}
+
+int digestFileMd5(int fd, uint64_t offset, uint64_t size, char *hex)
+{
+    return digestFile(fd, offset, size, EVP_md5(), hex);
+}
+
+int digestFileSha256(int fd, uint64_t offset, uint64_t size, char *hex)
+{
+    return digestFile(fd, offset, size, EVP_sha256(), hex);
+}
+
+int digestVerifySignature(const char *sha256, const unsigned char *signature, size_t signatureLen,
+                          const char *publicKeyFile)
+{
+    unsigned char digest[DIGEST_SHA256_HEX_LEN / 2];
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *key = NULL;
+    FILE *fp;
+    int ret = -1;
+
+    if (strlen(sha256) != DIGEST_SHA256_HEX_LEN) {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(digest); i++) {
+        unsigned int byte;
+        if (sscanf(sha256 + 2 * i, "%2x", &byte) != 1) {
+            return -1;
+        }
+        digest[i] = (unsigned char)byte;
+    }
+    if (!(fp = fopen(publicKeyFile, "re"))) {
+        return -1;
+    }
+    key = PEM_read_PUBKEY(fp, NULL, NULL, NULL);
+    fclose(fp);
+
+    /* the signature is checked against the digest already computed from the stream */
+    if (key && (ctx = EVP_PKEY_CTX_new(key, NULL)) != NULL && EVP_PKEY_verify_init(ctx) == 1 &&
+        EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256()) == 1 &&
+        EVP_PKEY_verify(ctx, signature, signatureLen, digest, sizeof(digest)) == 1) {
+        ret = 0;
+    }
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(key);
+    return ret;
+}
@@ -0,0 +1,108 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef MFRLIB_DIGEST_H
+#define MFRLIB_DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DIGEST_PIPE_BUFFER_SIZE (256 * 1024)
+#define DIGEST_MD5_HEX_LEN 32
+#define DIGEST_SHA256_HEX_LEN 64
+
+/*
+ * Pipeline hashing a stream on a separate thread. The reader fills buffers owned by the
+ * pipe and submits them; a hasher thread consumes them through a bounded single-producer,
+ * single-consumer queue. A submitted buffer stays valid for the reader until it acquires
+ * the next one, so the same bytes can be hashed and processed at once.
+ */
+typedef struct digestPipe digestPipe_t;
+
+typedef struct {
+    char md5[DIGEST_MD5_HEX_LEN + 1];
+    char sha256[DIGEST_SHA256_HEX_LEN + 1];     /* empty unless requested */
+} digestResult_t;
+
+/**
+ * @brief Start a pipe computing md5 and, if sha256 is set, sha256
+ * @return the pipe, NULL on failure
+ * @info If the hasher thread cannot be started, buffers are hashed as they are submitted.
+ */
+digestPipe_t *digestPipeStart(int sha256);
+
+/**
+ * @brief Get the next buffer to fill, DIGEST_PIPE_BUFFER_SIZE bytes long
+ * @info Blocks while every buffer is still queued for the hasher.
+ */
+unsigned char *digestPipeAcquire(digestPipe_t *pipe);
+
+/**
+ * @brief Queue the first len bytes of the buffer returned by the last digestPipeAcquire
+ */
+void digestPipeSubmit(digestPipe_t *pipe, size_t len);
+
+/**
+ * @brief Wait for the hasher to catch up and write out the digests of everything submitted so far
+ * @param result digests as lowercase hex
+ * @return 0 on success, -1 if a digest could not be computed
+ * @info The pipe carries on; the running digests are copied, not finished.
+ */
+int digestPipeSnapshot(digestPipe_t *pipe, digestResult_t *result);
+
+/**
+ * @brief Wait for the hasher to finish, write out the digests and release the pipe
+ * @param result digests of everything submitted, as lowercase hex; may be NULL to discard them
+ * @return 0 on success, -1 if a digest could not be computed
+ */
+int digestPipeFinish(digestPipe_t *pipe, digestResult_t *result);
+
+/**
+ * @brief Compute the md5 of a buffer in one go
+ * @param hex receives the digest as lowercase hex, DIGEST_MD5_HEX_LEN + 1 bytes
+ * @return 0 on success, -1 on failure
+ */
+int digestMd5(const unsigned char *buf, size_t len, char *hex);
+
+/**
+ * @brief Compute the md5 of a range of an open file
+ * @param hex receives the digest as lowercase hex, DIGEST_MD5_HEX_LEN + 1 bytes
+ * @return 0 on success, -1 if the range cannot be read in full
+ * @info Reads go through a page-aligned buffer, so fd may be opened with O_DIRECT as long as
+ *       offset and size are multiples of the device block size.
+ */
+int digestFileMd5(int fd, uint64_t offset, uint64_t size, char *hex);
+
+/**
+ * @brief Compute the sha256 of a range of an open file, as digestFileMd5 does the md5
+ * @param hex receives the digest as lowercase hex, DIGEST_SHA256_HEX_LEN + 1 bytes
+ */
+int digestFileSha256(int fd, uint64_t offset, uint64_t size, char *hex);
+
+/**
+ * @brief Check a detached signature of data given by its sha256
+ * @param sha256 digest of the signed data, as hex
+ * @param publicKeyFile PEM file holding the public key, RSA or EC
+ * @return 0 if the signature is valid, -1 if not or if it cannot be checked
+ * @info Matches signatures made with "openssl dgst -sha256 -sign key -out image.sig image".
+ */
+int digestVerifySignature(const char *sha256, const unsigned char *signature, size_t signatureLen,
+                          const char *publicKeyFile);
+
+#endif /* MFRLIB_DIGEST_H */
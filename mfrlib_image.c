@@ -0,0 +1,2242 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <linux/loop.h>
+#include <zlib.h>
+
+#include "mfrlib_copy.h"
+#include "mfrlib_digest.h"
+#include "mfrlib_image.h"
+#include "mfrlib_kvparser.h"
+#include "mfrlib_logger.h"
+
+#define DEVICE_PROPERTIES_FILE "/etc/device.properties"
+#define DEFAULT_PERSISTENT_PATH "/opt"
+#define PROC_CMDLINE_FILE "/proc/cmdline"
+#define PROC_MOUNTS_FILE "/proc/mounts"
+#define BOOT_DIR "/boot"
+#define BOOT_CMDLINE_FILE "/boot/cmdline.txt"
+#define BOOT_CMDLINE_NAME "cmdline.txt"               /* the same file, relative to /boot */
+#define BOOT_STAGING_DIR_NAME ".ota_staging"         /* in /boot, so that files can be renamed in */
+#define BOOT_BACKUP_DIR_NAME ".ota_backup"
+#define LOOP_CONTROL_DEVICE "/dev/loop-control"
+#define ROOTFS_BANK_A "/dev/mmcblk0p2"
+#define ROOTFS_BANK_B "/dev/mmcblk0p3"
+
+#define IMAGE_INFLATE_SIZE (1024 * 1024)
+#define IMAGE_WRITEBACK_SIZE (32 * 1024 * 1024)    /* start writeback of the bank every 32MB */
+#define IMAGE_COPY_SIZE (64 * 1024)
+#define IMAGE_CHECKPOINT_SIZE (128 * 1024 * 1024)  /* written .wic data between two journal checkpoints */
+#define IMAGE_IDENTITY_SIZE (1024 * 1024)           /* head of the image hashed to recognise it */
+#define JOURNAL_FILE_NAME "journal"
+#define DELTA_CHUNK_SIZE (1024 * 1024)              /* bank data read back per compare */
+#define DELTA_BLOCK_SIZE (64 * 1024)                /* unit of the compare; runs of changed blocks are written */
+#define ROOTFS_WRITE_MODE_KEY "OTA_ROOTFS_WRITE_MODE"
+#define IMAGE_SHA256_KEY "OTA_IMAGE_SHA256"
+#define IMAGE_PUBLIC_KEY_KEY "OTA_IMAGE_PUBLIC_KEY"
+#define VERIFY_READBACK_KEY "OTA_VERIFY_READBACK"
+#define IMAGE_SIGNATURE_MAX 1024                    /* room for RSA-8192 and any EC signature */
+#define TAR_BLOCK_SIZE 512
+#define TAR_META_MAX 8192                           /* GNU long name and pax header records */
+#define SECTOR_SIZE 512
+#define MBR_PARTITION_TABLE 446
+#define MBR_PARTITION_COUNT 4
+#define MBR_TYPE_GPT_PROTECTIVE 0xee
+#define WIC_BOOT_PARTITION 0
+#define WIC_ROOTFS_PARTITION 1
+#define EXT_MAGIC_OFFSET 1080
+
+/* Share of the progress given to streaming the image; the boot stage and bank switch follow */
+#define PROGRESS_STREAM_PERCENT 90
+#define PROGRESS_BOOT_PERCENT 98
+
+typedef enum {
+    IMAGE_FORMAT_TAR_GZ = 0,
+    IMAGE_FORMAT_TAR,
+    IMAGE_FORMAT_WIC,
+} imageFormat_t;
+
+typedef enum {
+    TAR_STATE_HEADER = 0,
+    TAR_STATE_DATA,             /* entry contents; routed to the .wic parser or skipped */
+    TAR_STATE_META,             /* GNU long name or pax header contents */
+    TAR_STATE_PADDING,
+    TAR_STATE_END,
+} tarState_t;
+
+typedef enum {
+    ROOTFS_WRITE_DELTA = 0,     /* raw, only the blocks that differ from the bank */
+    ROOTFS_WRITE_FULL,          /* raw, every block */
+    ROOTFS_WRITE_FILES,         /* file by file from the mounted image into the mounted bank */
+} rootfsWriteMode_t;
+
+static const char *const rootfsWriteModeNames[] = { "delta", "full", "file" };
+
+/* Stages of a write recorded in the journal, in order; each is complete and durable */
+typedef enum {
+    JOURNAL_STAGE_STREAM = 0,   /* partitions written up to the checkpoint offset */
+    JOURNAL_STAGE_WRITTEN,      /* image streamed: partitions and digests complete */
+    JOURNAL_STAGE_COPIED,       /* rootfs files copied into the bank */
+    JOURNAL_STAGE_BOOT,         /* /boot updated */
+} journalStage_t;
+
+static const char *const journalStageNames[] = { "stream", "written", "copied", "boot" };
+
+#define BOOT_CHANGE_OLD_MOVED 0x1
+#define BOOT_CHANGE_NEW_MOVED 0x2
+
+/* An entry of /boot that differs in the new boot partition; a directory is moved as a whole */
+typedef struct {
+    char *path;                 /* relative to /boot */
+    int hasOld;                 /* the old entry is moved into the backup directory */
+    int hasNew;                 /* the new entry is moved in from the staging directory */
+    int moved;                  /* BOOT_CHANGE_* steps done, undone in reverse on failure */
+} bootChange_t;
+
+typedef struct {
+    int bootFd;
+    int newFd;                  /* mounted new boot partition */
+    int stagingFd;
+    int backupFd;
+    bootChange_t *changes;
+    size_t count;
+    size_t capacity;
+    size_t unchanged;
+    unsigned char *compare[2];
+} bootUpdate_t;
+
+typedef struct {
+    uint64_t start;             /* byte offset in the .wic */
+    uint64_t size;
+    uint8_t type;
+} wicPartition_t;
+
+typedef struct {
+    /* source image */
+    int fd;
+    imageFormat_t format;
+    uint64_t fileSize;
+    uint64_t consumed;
+    z_stream zs;
+    int zsInitialized;
+    int zsEnded;
+    int sha256;                 /* also compute the sha256 of the image */
+    digestPipe_t *imageDigest;  /* while streaming */
+    digestResult_t digests;
+
+    /* verification: digests from .md5/.sha256 files beside the image, a .sig checked with the public key */
+    char expectedMd5[DIGEST_MD5_HEX_LEN + 1];
+    char expectedSha256[DIGEST_SHA256_HEX_LEN + 1];
+    unsigned char signature[IMAGE_SIGNATURE_MAX + 1];   /* one spare byte to detect oversized files */
+    size_t signatureLen;
+    char publicKey[PATH_MAX];
+
+    /* the rootfs is hashed as it streams, then read back from the bank and hashed again */
+    int readback;
+    digestPipe_t *rootfsDigest;
+    unsigned char *rootfsHashBuf;
+    size_t rootfsHashLen;
+    char rootfsMd5[DIGEST_MD5_HEX_LEN + 1];
+    uint64_t rootfsSize;
+    pthread_t readbackThread;
+    int readbackRunning;
+    mfrError_t readbackResult;
+
+    /* tar stream */
+    tarState_t tarState;
+    unsigned char header[TAR_BLOCK_SIZE];
+    size_t headerLen;
+    uint64_t entryRemaining;
+    uint64_t entryPadding;
+    int entryIsWic;
+    char metaType;
+    char meta[TAR_META_MAX];
+    size_t metaLen;
+    char longName[PATH_MAX];
+
+    /* .wic disk image */
+    int wicFound;
+    uint64_t wicOffset;
+    unsigned char mbr[SECTOR_SIZE];
+    wicPartition_t partitions[MBR_PARTITION_COUNT];
+    int partitionsParsed;
+
+    /* targets */
+    int bootFd;                 /* staged boot partition */
+    int rootfsFd;               /* passive rootfs bank, or the staged rootfs when copying files */
+    rootfsWriteMode_t rootfsMode;
+    char rootfsTarget[PATH_MAX];
+    uint64_t rootfsCapacity;
+    uint64_t rootfsSyncFrom;
+    uint64_t rootfsUnsynced;
+
+    /* delta write of the rootfs: the image is compared with the bank a chunk at a time */
+    unsigned char *deltaChunk;
+    unsigned char *deltaExisting;
+    uint64_t deltaOffset;
+    size_t deltaLen;
+    uint64_t rootfsWritten;
+    uint64_t rootfsUnchanged;
+    char activeBank[PATH_MAX];
+    char passiveBank[PATH_MAX];
+    char otaDir[PATH_MAX];
+    char bootImage[PATH_MAX];
+    char rootfsImage[PATH_MAX];
+
+    /* checkpoint journal: an interrupted write of the same image resumes from the last checkpoint */
+    char journalPath[PATH_MAX];
+    char imageIdentity[128];    /* size, mtime and md5 of the head of the image */
+    digestResult_t journalDigests;  /* of the whole image, as last streamed; only compared, never trusted */
+    digestResult_t prefixDigests;   /* of the image up to prefixSize, as read by the last checkpoint */
+    uint64_t prefixSize;
+    journalStage_t stage;
+    uint64_t resumeFrom;        /* .wic offset below which the partitions are already written */
+    uint64_t checkpoint;        /* .wic offset of the last checkpoint */
+    int journaled;              /* the journal describes this write; staged files are kept on failure */
+
+    /* progress */
+    mfrUpgradeStatusNotify_t notify;
+    int lastPercent;
+    time_t lastNotify;
+} imageWriter_t;
+
+static atomic_int imageWriteBusy = 0;
+
+static void notifyProgress(imageWriter_t *w, mfrUpgradeProgress_t progress, mfrError_t error, int percent)
+{
+    mfrUpgradeStatus_t status;
+    time_t now = time(NULL);
+
+    if (!w->notify.cb) {
+        return;
+    }
+    if (progress == mfrUPGRADE_PROGRESS_STARTED && w->lastNotify != 0) {
+        /* periodic update: only on change, and no more often than the requested interval */
+        if (percent == w->lastPercent ||
+            (w->notify.interval > 0 && now - w->lastNotify < w->notify.interval)) {
+            return;
+        }
+    }
+    status.progress = progress;
+    status.error = error;
+    status.percentage = percent;
+    w->lastPercent = percent;
+    w->lastNotify = now;
+    w->notify.cb(status, w->notify.cbData);
+}
+
+static int pwriteAll(int fd, const unsigned char *buf, size_t len, uint64_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read a small text file, NUL terminated; a relative path is taken from dirFd
+ * @return number of bytes read, -1 on failure
+ */
+static ssize_t readTextFileAt(int dirFd, const char *path, char *buf, size_t size)
+{
+    int fd = openat(dirFd, path, O_RDONLY | O_CLOEXEC);
+    ssize_t len;
+
+    if (fd == -1) {
+        return -1;
+    }
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+static ssize_t readTextFile(const char *path, char *buf, size_t size)
+{
+    return readTextFileAt(AT_FDCWD, path, buf, size);
+}
+
+/**
+ * @brief Replace a file atomically: write a new copy beside it, sync it and rename it over the file
+ * @return 0 on success, -1 on failure
+ */
+static int replaceFile(const char *path, const char *data, size_t len)
+{
+    char tmpPath[PATH_MAX];
+    char *slash;
+    int fd;
+
+    if (snprintf(tmpPath, sizeof(tmpPath), "%s.new", path) >= (int)sizeof(tmpPath)) {
+        return -1;
+    }
+    fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        mfrlib_log("replaceFile failed to create '%s': %s\n", tmpPath, strerror(errno));
+        return -1;
+    }
+    if (pwriteAll(fd, (const unsigned char *)data, len, 0) == -1 || fsync(fd) == -1) {
+        mfrlib_log("replaceFile failed to write '%s': %s\n", tmpPath, strerror(errno));
+        close(fd);
+        unlink(tmpPath);
+        return -1;
+    }
+    close(fd);
+    if (rename(tmpPath, path) == -1) {
+        mfrlib_log("replaceFile failed to replace '%s': %s\n", path, strerror(errno));
+        unlink(tmpPath);
+        return -1;
+    }
+    /* make the rename itself durable */
+    if ((slash = strrchr(tmpPath, '/')) != NULL) {
+        *(slash == tmpPath ? slash + 1 : slash) = '\0';
+        if ((fd = open(tmpPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Find the value of the root= kernel argument in a command line
+ * @return pointer to the value and its length in len, NULL if absent
+ */
+static const char *findRootArgument(const char *cmdline, size_t *len)
+{
+    for (const char *pos = cmdline; (pos = strstr(pos, "root=")) != NULL; pos += 5) {
+        if (pos == cmdline || pos[-1] == ' ' || pos[-1] == '\t') {
+            *len = strcspn(pos + 5, " \t\n");
+            return pos + 5;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Work out the active rootfs bank from /proc/cmdline; the passive bank is the other one
+ *
+ * root= has to name one of the two banks, and the passive one must not be the device / is on.
+ */
+static mfrError_t findRootfsBanks(imageWriter_t *w)
+{
+    char cmdline[4096];
+    const char *root;
+    size_t len;
+    struct stat bank;
+    struct stat running;
+
+    if (readTextFile(PROC_CMDLINE_FILE, cmdline, sizeof(cmdline)) == -1) {
+        mfrlib_log("findRootfsBanks failed to read '%s'\n", PROC_CMDLINE_FILE);
+        return mfrERR_GENERAL;
+    }
+    root = findRootArgument(cmdline, &len);
+    if (!root || len >= sizeof(w->activeBank)) {
+        mfrlib_log("findRootfsBanks no root= argument in '%s'\n", PROC_CMDLINE_FILE);
+        return mfrERR_GENERAL;
+    }
+    snprintf(w->activeBank, sizeof(w->activeBank), "%.*s", (int)len, root);
+    /* PARTUUID=, /dev/root and the like do not tell which bank runs; never guess */
+    if (strcmp(w->activeBank, ROOTFS_BANK_A) == 0) {
+        snprintf(w->passiveBank, sizeof(w->passiveBank), "%s", ROOTFS_BANK_B);
+    } else if (strcmp(w->activeBank, ROOTFS_BANK_B) == 0) {
+        snprintf(w->passiveBank, sizeof(w->passiveBank), "%s", ROOTFS_BANK_A);
+    } else {
+        mfrlib_log("findRootfsBanks root='%s' is neither '%s' nor '%s'\n", w->activeBank, ROOTFS_BANK_A,
+                   ROOTFS_BANK_B);
+        return mfrERR_GENERAL;
+    }
+    /* whatever the command line says, the bank holding / is not written */
+    if (stat(w->passiveBank, &bank) == -1 || stat("/", &running) == -1) {
+        mfrlib_log("findRootfsBanks failed to check '%s': %s\n", w->passiveBank, strerror(errno));
+        return mfrERR_GENERAL;
+    }
+    if (!S_ISBLK(bank.st_mode) || bank.st_rdev == running.st_dev) {
+        mfrlib_log("findRootfsBanks '%s' is not a block device or holds the running rootfs\n", w->passiveBank);
+        return mfrERR_GENERAL;
+    }
+    mfrlib_log("findRootfsBanks active '%s' passive '%s'\n", w->activeBank, w->passiveBank);
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Unmount the passive bank if something mounted it; it is about to be overwritten raw
+ */
+static mfrError_t unmountPassiveBank(const imageWriter_t *w)
+{
+    char device[PATH_MAX];
+    char mountPoint[PATH_MAX];
+    char line[2 * PATH_MAX];
+    FILE *fp = fopen(PROC_MOUNTS_FILE, "re");
+    mfrError_t ret = mfrERR_NONE;
+
+    if (!fp) {
+        return mfrERR_NONE;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%4095s %4095s", device, mountPoint) != 2 || strcmp(device, w->passiveBank) != 0) {
+            continue;
+        }
+        mfrlib_log("unmountPassiveBank unmounting '%s' from '%s'\n", device, mountPoint);
+        if (umount(mountPoint) == -1) {
+            mfrlib_log("unmountPassiveBank failed to unmount '%s': %s\n", mountPoint, strerror(errno));
+            ret = mfrERR_INVALID_STATE;
+            break;
+        }
+    }
+    fclose(fp);
+    return ret;
+}
+
+/**
+ * @brief Record the last completed stage and checkpoint of the write, replacing the journal atomically
+ * @info A journal that cannot be written only costs the ability to resume, so it is not an error.
+ */
+static void saveJournal(imageWriter_t *w, journalStage_t stage)
+{
+    char journal[1024];
+    int len;
+
+    len = snprintf(journal, sizeof(journal),
+                   "# mfrWriteImage checkpoint journal\n"
+                   "IMAGE=%s\nBANK=%s\nMODE=%s\nSTAGE=%s\nCHECKPOINT=%llu\nDIGEST_MD5=%s\nDIGEST_SHA256=%s\n"
+                   "PREFIX_SIZE=%llu\nPREFIX_MD5=%s\nPREFIX_SHA256=%s\n",
+                   w->imageIdentity, w->passiveBank, rootfsWriteModeNames[w->rootfsMode], journalStageNames[stage],
+                   (unsigned long long)w->checkpoint, w->digests.md5, w->digests.sha256,
+                   (unsigned long long)w->prefixSize, w->prefixDigests.md5, w->prefixDigests.sha256);
+    if (len >= (int)sizeof(journal) || replaceFile(w->journalPath, journal, (size_t)len) == -1) {
+        mfrlib_log("saveJournal failed to write '%s'\n", w->journalPath);
+        return;
+    }
+    w->stage = stage;
+    w->journaled = 1;
+}
+
+/**
+ * @brief Forget the journal, so that the partitions are written from the start
+ */
+static void dropJournal(imageWriter_t *w)
+{
+    unlink(w->journalPath);
+    memset(&w->journalDigests, 0, sizeof(w->journalDigests));
+    memset(&w->prefixDigests, 0, sizeof(w->prefixDigests));
+    w->prefixSize = 0;
+    w->stage = JOURNAL_STAGE_STREAM;
+    w->checkpoint = w->resumeFrom = 0;
+    w->journaled = 0;
+}
+
+/**
+ * @brief Check that the image starts with what the last checkpoint had read of it
+ * @return 0 if the digests of the prefix match those recorded in the journal, -1 if not
+ */
+static int checkJournalPrefix(imageWriter_t *w)
+{
+    char md5[DIGEST_MD5_HEX_LEN + 1];
+    char sha256[DIGEST_SHA256_HEX_LEN + 1];
+
+    if (!w->prefixDigests.md5[0] || w->prefixSize > w->fileSize ||
+        digestFileMd5(w->fd, 0, w->prefixSize, md5) == -1 || strcmp(md5, w->prefixDigests.md5) != 0) {
+        return -1;
+    }
+    if (w->prefixDigests.sha256[0] &&
+        (digestFileSha256(w->fd, 0, w->prefixSize, sha256) == -1 || strcmp(sha256, w->prefixDigests.sha256) != 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Pick up the journal of an interrupted write of the same image to the same bank, else drop it
+ * @info The journal is only a hint of what is already written. A write interrupted while streaming
+ *       resumes only if the image still starts with the bytes the checkpoint had read, hashed again
+ *       here. The image is then streamed and hashed again in full, and once written in full its
+ *       digests are compared with those recorded in the journal.
+ */
+static void loadJournal(imageWriter_t *w)
+{
+    char value[PATH_MAX];
+    char checkpoint[32] = "0";
+    char prefixSize[32] = "0";
+    kvFile_t kv;
+    int stage = -1;
+
+    if (kvFileLoad(&kv, w->journalPath, '=') == -1) {
+        /* a staged rootfs left without its journal cannot be trusted */
+        unlink(w->rootfsImage);
+        return;
+    }
+    if (kvFileLookup(&kv, "IMAGE", value, sizeof(value)) == 0 && strcmp(value, w->imageIdentity) == 0 &&
+        kvFileLookup(&kv, "BANK", value, sizeof(value)) == 0 && strcmp(value, w->passiveBank) == 0 &&
+        kvFileLookup(&kv, "MODE", value, sizeof(value)) == 0 && strcmp(value, rootfsWriteModeNames[w->rootfsMode]) == 0 &&
+        kvFileLookup(&kv, "STAGE", value, sizeof(value)) == 0) {
+        for (int i = 0; i < (int)(sizeof(journalStageNames) / sizeof(journalStageNames[0])); i++) {
+            if (strcmp(value, journalStageNames[i]) == 0) {
+                stage = i;
+            }
+        }
+        kvFileLookup(&kv, "CHECKPOINT", checkpoint, sizeof(checkpoint));
+        kvFileLookup(&kv, "DIGEST_MD5", w->journalDigests.md5, sizeof(w->journalDigests.md5));
+        kvFileLookup(&kv, "DIGEST_SHA256", w->journalDigests.sha256, sizeof(w->journalDigests.sha256));
+        kvFileLookup(&kv, "PREFIX_SIZE", prefixSize, sizeof(prefixSize));
+        kvFileLookup(&kv, "PREFIX_MD5", w->prefixDigests.md5, sizeof(w->prefixDigests.md5));
+        kvFileLookup(&kv, "PREFIX_SHA256", w->prefixDigests.sha256, sizeof(w->prefixDigests.sha256));
+    }
+    kvFileRelease(&kv);
+
+    /* the staged partitions must have survived too */
+    if (access(w->bootImage, F_OK) == -1 ||
+        (w->rootfsMode == ROOTFS_WRITE_FILES && w->format != IMAGE_FORMAT_WIC && access(w->rootfsImage, F_OK) == -1)) {
+        stage = -1;
+    }
+    w->prefixSize = strtoull(prefixSize, NULL, 10);
+    if (stage == JOURNAL_STAGE_STREAM && checkJournalPrefix(w) == -1) {
+        mfrlib_log("loadJournal the image does not start with what the checkpoint had read\n");
+        stage = -1;
+    }
+    if (stage == -1) {
+        mfrlib_log("loadJournal discarding the journal of another write\n");
+        dropJournal(w);
+        unlink(w->rootfsImage);
+        return;
+    }
+    w->stage = (journalStage_t)stage;
+    w->checkpoint = w->resumeFrom = strtoull(checkpoint, NULL, 10);
+    w->journaled = 1;
+    mfrlib_log("loadJournal resuming after stage '%s', partitions written up to %llu\n",
+               journalStageNames[w->stage], (unsigned long long)w->resumeFrom);
+}
+
+static mfrError_t openTargets(imageWriter_t *w)
+{
+    char persistentPath[PATH_MAX] = DEFAULT_PERSISTENT_PATH;
+    char writeMode[16] = "delta";
+    char sha256[8] = "false";
+    char readback[8] = "true";
+    char publicKey[PATH_MAX] = "";
+    kvFile_t kv;
+    struct stat st;
+
+    if (kvFileLoad(&kv, DEVICE_PROPERTIES_FILE, '=') == 0) {
+        if (kvFileLookup(&kv, "PERSISTENT_PATH", persistentPath, sizeof(persistentPath)) == -1 ||
+            persistentPath[0] != '/') {
+            snprintf(persistentPath, sizeof(persistentPath), "%s", DEFAULT_PERSISTENT_PATH);
+        }
+        kvFileLookup(&kv, ROOTFS_WRITE_MODE_KEY, writeMode, sizeof(writeMode));
+        kvFileLookup(&kv, IMAGE_SHA256_KEY, sha256, sizeof(sha256));
+        kvFileLookup(&kv, IMAGE_PUBLIC_KEY_KEY, publicKey, sizeof(publicKey));
+        kvFileLookup(&kv, VERIFY_READBACK_KEY, readback, sizeof(readback));
+        kvFileRelease(&kv);
+    }
+    /* the bank is read back and only changed blocks are written, unless "full" or "file" is configured */
+    if (strcmp(writeMode, "full") == 0) {
+        w->rootfsMode = ROOTFS_WRITE_FULL;
+    } else if (strcmp(writeMode, "file") == 0) {
+        w->rootfsMode = ROOTFS_WRITE_FILES;
+    } else {
+        w->rootfsMode = ROOTFS_WRITE_DELTA;
+    }
+    /* with a public key configured, only signed images are written */
+    if (publicKey[0]) {
+        snprintf(w->publicKey, sizeof(w->publicKey), "%s", publicKey);
+        if (w->signatureLen == 0) {
+            mfrlib_log("openTargets the image has no signature\n");
+            return mfrERR_FLASH_VERIFY_FAILED;
+        }
+    }
+    w->sha256 = (strcmp(sha256, "true") == 0 || w->expectedSha256[0] || w->publicKey[0]);
+    /* the copied files of the file mode are not read back */
+    w->readback = (strcmp(readback, "false") != 0 && w->rootfsMode != ROOTFS_WRITE_FILES);
+    if (w->rootfsMode == ROOTFS_WRITE_DELTA) {
+        w->deltaChunk = malloc(DELTA_CHUNK_SIZE);
+        w->deltaExisting = malloc(DELTA_CHUNK_SIZE);
+        if (!w->deltaChunk || !w->deltaExisting) {
+            return mfrERR_MEMORY_EXHAUSTED;
+        }
+    }
+    snprintf(w->otaDir, sizeof(w->otaDir), "%s/ota", persistentPath);
+    if (mkdir(w->otaDir, 0755) == -1 && errno != EEXIST) {
+        mfrlib_log("openTargets failed to create '%s': %s\n", w->otaDir, strerror(errno));
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+
+    if (snprintf(w->bootImage, sizeof(w->bootImage), "%s/boot.img", w->otaDir) >= (int)sizeof(w->bootImage) ||
+        snprintf(w->rootfsImage, sizeof(w->rootfsImage), "%s/rootfs.img", w->otaDir) >= (int)sizeof(w->rootfsImage) ||
+        snprintf(w->journalPath, sizeof(w->journalPath), "%s/%s", w->otaDir, JOURNAL_FILE_NAME) >= (int)sizeof(w->journalPath)) {
+        return mfrERR_INVALID_PARAM;
+    }
+    /* staged partitions are kept by an interrupted write of the same image */
+    loadJournal(w);
+    w->bootFd = open(w->bootImage, O_RDWR | O_CREAT | (w->journaled ? 0 : O_TRUNC) | O_CLOEXEC, 0600);
+    if (w->bootFd == -1) {
+        mfrlib_log("openTargets failed to create '%s': %s\n", w->bootImage, strerror(errno));
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+
+    if (w->rootfsMode == ROOTFS_WRITE_FILES) {
+        /* the files are copied into the bank as it is, whatever its size */
+        w->rootfsCapacity = UINT64_MAX;
+        if (w->format == IMAGE_FORMAT_WIC) {
+            /* the rootfs is mounted straight from the image */
+            return mfrERR_NONE;
+        }
+        snprintf(w->rootfsTarget, sizeof(w->rootfsTarget), "%s", w->rootfsImage);
+        w->rootfsFd = open(w->rootfsImage, O_RDWR | O_CREAT | (w->journaled ? 0 : O_TRUNC) | O_CLOEXEC, 0600);
+        if (w->rootfsFd == -1) {
+            mfrlib_log("openTargets failed to create '%s': %s\n", w->rootfsImage, strerror(errno));
+            return mfrERR_FLASH_WRITE_FAILED;
+        }
+        return mfrERR_NONE;
+    }
+
+    snprintf(w->rootfsTarget, sizeof(w->rootfsTarget), "%s", w->passiveBank);
+    w->rootfsFd = open(w->rootfsTarget, (w->rootfsMode == ROOTFS_WRITE_DELTA ? O_RDWR : O_WRONLY) | O_CLOEXEC);
+    if (w->rootfsFd == -1 || fstat(w->rootfsFd, &st) == -1) {
+        mfrlib_log("openTargets failed to open '%s': %s\n", w->rootfsTarget, strerror(errno));
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+    w->rootfsCapacity = (uint64_t)st.st_size;
+    if (S_ISBLK(st.st_mode) && ioctl(w->rootfsFd, BLKGETSIZE64, &w->rootfsCapacity) == -1) {
+        mfrlib_log("openTargets failed to size '%s': %s\n", w->rootfsTarget, strerror(errno));
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Parse the MBR partition table of the .wic and check the partitions fit their targets
+ */
+static mfrError_t parsePartitionTable(imageWriter_t *w)
+{
+    const unsigned char *mbr = w->mbr;
+
+    if (mbr[510] != 0x55 || mbr[511] != 0xaa) {
+        mfrlib_log("parsePartitionTable no MBR signature\n");
+        return mfrERR_GENERAL;
+    }
+    for (int i = 0; i < MBR_PARTITION_COUNT; i++) {
+        const unsigned char *entry = mbr + MBR_PARTITION_TABLE + 16 * i;
+        uint32_t lba = (uint32_t)entry[8] | (uint32_t)entry[9] << 8 | (uint32_t)entry[10] << 16 | (uint32_t)entry[11] << 24;
+        uint32_t sectors = (uint32_t)entry[12] | (uint32_t)entry[13] << 8 | (uint32_t)entry[14] << 16 | (uint32_t)entry[15] << 24;
+
+        w->partitions[i].type = entry[4];
+        w->partitions[i].start = (uint64_t)lba * SECTOR_SIZE;
+        w->partitions[i].size = (uint64_t)sectors * SECTOR_SIZE;
+        if (entry[4] == MBR_TYPE_GPT_PROTECTIVE) {
+            mfrlib_log("parsePartitionTable GPT images are not supported\n");
+            return mfrERR_GENERAL;
+        }
+    }
+    if (w->partitions[WIC_BOOT_PARTITION].size == 0 || w->partitions[WIC_ROOTFS_PARTITION].size == 0) {
+        mfrlib_log("parsePartitionTable boot or rootfs partition missing\n");
+        return mfrERR_GENERAL;
+    }
+    if (w->partitions[WIC_ROOTFS_PARTITION].size > w->rootfsCapacity) {
+        mfrlib_log("parsePartitionTable rootfs of %llu bytes does not fit '%s' of %llu bytes\n",
+                   (unsigned long long)w->partitions[WIC_ROOTFS_PARTITION].size, w->passiveBank,
+                   (unsigned long long)w->rootfsCapacity);
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+    if (ftruncate(w->bootFd, (off_t)w->partitions[WIC_BOOT_PARTITION].size) == -1) {
+        mfrlib_log("parsePartitionTable failed to size '%s': %s\n", w->bootImage, strerror(errno));
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+    mfrlib_log("parsePartitionTable boot %llu+%llu rootfs %llu+%llu\n",
+               (unsigned long long)w->partitions[WIC_BOOT_PARTITION].start,
+               (unsigned long long)w->partitions[WIC_BOOT_PARTITION].size,
+               (unsigned long long)w->partitions[WIC_ROOTFS_PARTITION].start,
+               (unsigned long long)w->partitions[WIC_ROOTFS_PARTITION].size);
+    w->partitionsParsed = 1;
+    return mfrERR_NONE;
+}
+
+static mfrError_t writeRootfs(imageWriter_t *w, uint64_t offset, const unsigned char *buf, size_t len)
+{
+    if (pwriteAll(w->rootfsFd, buf, len, offset) == -1) {
+        mfrlib_log("writeRootfs failed to write '%s': %s\n", w->rootfsTarget, strerror(errno));
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+    w->rootfsWritten += len;
+
+    /* keep the dirty page cache bounded, so the final fsync does not stall for long */
+    w->rootfsUnsynced += len;
+    if (w->rootfsUnsynced >= IMAGE_WRITEBACK_SIZE) {
+        sync_file_range(w->rootfsFd, (off_t)w->rootfsSyncFrom, (off_t)(offset + len - w->rootfsSyncFrom),
+                        SYNC_FILE_RANGE_WRITE);
+        w->rootfsSyncFrom = offset + len;
+        w->rootfsUnsynced = 0;
+    }
+    return mfrERR_NONE;
+}
+
+static ssize_t preadAll(int fd, unsigned char *buf, size_t len, uint64_t offset)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, (off_t)(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+/**
+ * @brief Compare the buffered chunk of the rootfs with the bank and write the blocks that differ
+ * @info Adjacent changed blocks are written with one call. If the bank cannot be read back, the
+ *       whole chunk is written.
+ */
+static mfrError_t flushDeltaChunk(imageWriter_t *w)
+{
+    size_t len = w->deltaLen;
+    size_t runStart = 0;
+    int inRun = 0;
+    mfrError_t ret;
+
+    if (len == 0) {
+        return mfrERR_NONE;
+    }
+    if (preadAll(w->rootfsFd, w->deltaExisting, len, w->deltaOffset) != (ssize_t)len) {
+        ret = writeRootfs(w, w->deltaOffset, w->deltaChunk, len);
+        w->deltaOffset += len;
+        w->deltaLen = 0;
+        return ret;
+    }
+
+    /* one extra pass at pos == len closes the last run */
+    for (size_t pos = 0, blockLen; pos <= len; pos += (blockLen ? blockLen : 1)) {
+        int changed;
+
+        blockLen = (len - pos < DELTA_BLOCK_SIZE) ? len - pos : DELTA_BLOCK_SIZE;
+        changed = (blockLen > 0) && memcmp(w->deltaChunk + pos, w->deltaExisting + pos, blockLen) != 0;
+
+        if (changed && !inRun) {
+            runStart = pos;
+            inRun = 1;
+        } else if (!changed && inRun) {
+            ret = writeRootfs(w, w->deltaOffset + runStart, w->deltaChunk + runStart, pos - runStart);
+            if (ret != mfrERR_NONE) {
+                return ret;
+            }
+            inRun = 0;
+        }
+        if (!changed) {
+            w->rootfsUnchanged += blockLen;
+        }
+    }
+    w->deltaOffset += len;
+    w->deltaLen = 0;
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Write data of one partition at the given offset within that partition
+ */
+static mfrError_t writePartition(imageWriter_t *w, int partition, uint64_t offset, const unsigned char *buf, size_t len)
+{
+    mfrError_t ret;
+
+    if (partition == WIC_BOOT_PARTITION) {
+        if (pwriteAll(w->bootFd, buf, len, offset) == -1) {
+            mfrlib_log("writePartition failed to write '%s': %s\n", w->bootImage, strerror(errno));
+            return mfrERR_FLASH_WRITE_FAILED;
+        }
+        return mfrERR_NONE;
+    }
+    if (w->rootfsFd == -1) {
+        /* copying files from a bare .wic: the rootfs is read from the image later */
+        return mfrERR_NONE;
+    }
+    if (w->rootfsMode != ROOTFS_WRITE_DELTA) {
+        return writeRootfs(w, offset, buf, len);
+    }
+
+    /* the rootfs arrives in order; buffer it into chunks aligned on the partition start */
+    while (len > 0) {
+        size_t n;
+
+        if (w->deltaLen == DELTA_CHUNK_SIZE || (w->deltaLen > 0 && offset != w->deltaOffset + w->deltaLen)) {
+            if ((ret = flushDeltaChunk(w)) != mfrERR_NONE) {
+                return ret;
+            }
+        }
+        if (w->deltaLen == 0) {
+            w->deltaOffset = offset;
+        }
+        n = DELTA_CHUNK_SIZE - w->deltaLen;
+        n = (n < len) ? n : len;
+        memcpy(w->deltaChunk + w->deltaLen, buf, n);
+        w->deltaLen += n;
+        offset += n;
+        buf += n;
+        len -= n;
+    }
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Pass rootfs data to the hasher, in full buffers
+ */
+static void hashRootfs(imageWriter_t *w, const unsigned char *buf, size_t len)
+{
+    while (len > 0) {
+        size_t n;
+
+        if (!w->rootfsHashBuf) {
+            w->rootfsHashBuf = digestPipeAcquire(w->rootfsDigest);
+            w->rootfsHashLen = 0;
+        }
+        n = DIGEST_PIPE_BUFFER_SIZE - w->rootfsHashLen;
+        n = (n < len) ? n : len;
+        memcpy(w->rootfsHashBuf + w->rootfsHashLen, buf, n);
+        w->rootfsHashLen += n;
+        buf += n;
+        len -= n;
+        if (w->rootfsHashLen == DIGEST_PIPE_BUFFER_SIZE) {
+            digestPipeSubmit(w->rootfsDigest, DIGEST_PIPE_BUFFER_SIZE);
+            w->rootfsHashBuf = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Make everything written so far durable and record it in the journal
+ */
+static mfrError_t checkpointPartitions(imageWriter_t *w)
+{
+    mfrError_t ret;
+
+    if (w->rootfsMode == ROOTFS_WRITE_DELTA && (ret = flushDeltaChunk(w)) != mfrERR_NONE) {
+        return ret;
+    }
+    if ((w->rootfsFd != -1 && fdatasync(w->rootfsFd) == -1) || fdatasync(w->bootFd) == -1) {
+        mfrlib_log("checkpointPartitions sync failed: %s\n", strerror(errno));
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+    /* a resume must find the image unchanged up to here, not only its identity */
+    w->checkpoint = w->wicOffset;
+    if (digestPipeSnapshot(w->imageDigest, &w->prefixDigests) == -1) {
+        mfrlib_log("checkpointPartitions failed to compute the digests of the image so far\n");
+        return mfrERR_NONE;
+    }
+    w->prefixSize = w->consumed;
+    saveJournal(w, JOURNAL_STAGE_STREAM);
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Consume the next bytes of the .wic: the MBR, then the boot and rootfs partitions
+ * @info Partition data below the resume offset was written by an interrupted attempt and is skipped.
+ */
+static mfrError_t feedWic(imageWriter_t *w, const unsigned char *buf, size_t len)
+{
+    mfrError_t ret;
+
+    if (w->wicOffset < SECTOR_SIZE) {
+        size_t n = SECTOR_SIZE - (size_t)w->wicOffset;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(w->mbr + w->wicOffset, buf, n);
+        w->wicOffset += n;
+        buf += n;
+        len -= n;
+        if (w->wicOffset == SECTOR_SIZE && (ret = parsePartitionTable(w)) != mfrERR_NONE) {
+            return ret;
+        }
+    }
+
+    for (int i = WIC_BOOT_PARTITION; i <= WIC_ROOTFS_PARTITION && len > 0; i++) {
+        const wicPartition_t *part = &w->partitions[i];
+        uint64_t begin = (w->wicOffset > part->start) ? w->wicOffset : part->start;
+        uint64_t end = (w->wicOffset + len < part->start + part->size) ? w->wicOffset + len : part->start + part->size;
+
+        /* hashed whether written now or by an interrupted attempt, to be compared with the bank */
+        if (i == WIC_ROOTFS_PARTITION && w->rootfsDigest && begin < end) {
+            hashRootfs(w, buf + (begin - w->wicOffset), (size_t)(end - begin));
+        }
+        if (begin < w->resumeFrom) {
+            begin = w->resumeFrom;
+        }
+        if (begin < end) {
+            ret = writePartition(w, i, begin - part->start, buf + (begin - w->wicOffset), (size_t)(end - begin));
+            if (ret != mfrERR_NONE) {
+                return ret;
+            }
+        }
+    }
+    w->wicOffset += len;
+    if (w->partitionsParsed && w->wicOffset > w->resumeFrom && w->wicOffset - w->checkpoint >= IMAGE_CHECKPOINT_SIZE) {
+        return checkpointPartitions(w);
+    }
+    return mfrERR_NONE;
+}
+
+static uint64_t parseTarNumber(const unsigned char *field, size_t size)
+{
+    uint64_t value = 0;
+
+    if (field[0] & 0x80) {
+        /* GNU base-256 encoding, used for entries of 8GB and more */
+        value = field[0] & 0x3f;
+        for (size_t i = 1; i < size; i++) {
+            value = (value << 8) | field[i];
+        }
+        return value;
+    }
+    for (size_t i = 0; i < size && field[i] != '\0'; i++) {
+        if (field[i] >= '0' && field[i] <= '7') {
+            value = (value << 3) | (uint64_t)(field[i] - '0');
+        } else if (field[i] != ' ' || value != 0) {
+            break;
+        }
+    }
+    return value;
+}
+
+static int isZeroBlock(const unsigned char *block)
+{
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+        if (block[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int nameIsWic(const char *name)
+{
+    size_t len = strlen(name);
+
+    return len > 4 && strcmp(name + len - 4, ".wic") == 0;
+}
+
+/**
+ * @brief Take the path of the next entry from a pax extended header
+ */
+static void parsePaxHeader(imageWriter_t *w)
+{
+    size_t pos = 0;
+
+    while (pos < w->metaLen) {
+        char *record = w->meta + pos;
+        char *end;
+        unsigned long len = strtoul(record, &end, 10);
+
+        if (len == 0 || pos + len > w->metaLen || *end != ' ') {
+            return;
+        }
+        if (strncmp(end + 1, "path=", 5) == 0) {
+            size_t valueLen = (size_t)(record + len - 1 - (end + 6));
+            if (valueLen < sizeof(w->longName)) {
+                snprintf(w->longName, sizeof(w->longName), "%.*s", (int)valueLen, end + 6);
+            }
+        }
+        pos += len;
+    }
+}
+
+static mfrError_t parseTarHeader(imageWriter_t *w)
+{
+    const unsigned char *h = w->header;
+    unsigned int checksum = 0;
+    char name[PATH_MAX];
+    char type = (char)h[156];
+
+    if (isZeroBlock(h)) {
+        w->tarState = TAR_STATE_END;
+        return mfrERR_NONE;
+    }
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+        checksum += (i >= 148 && i < 156) ? ' ' : h[i];
+    }
+    if (checksum != parseTarNumber(h + 148, 8)) {
+        mfrlib_log("parseTarHeader bad header checksum\n");
+        return mfrERR_GENERAL;
+    }
+
+    w->entryRemaining = parseTarNumber(h + 124, 12);
+    w->entryPadding = (TAR_BLOCK_SIZE - w->entryRemaining % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    w->entryIsWic = 0;
+
+    if (type == 'L' || type == 'x') {
+        if (w->entryRemaining >= sizeof(w->meta)) {
+            mfrlib_log("parseTarHeader extended header of %llu bytes too large\n", (unsigned long long)w->entryRemaining);
+            return mfrERR_GENERAL;
+        }
+        w->metaType = type;
+        w->metaLen = 0;
+        w->tarState = w->entryRemaining ? TAR_STATE_META : TAR_STATE_PADDING;
+        return mfrERR_NONE;
+    }
+
+    if (w->longName[0]) {
+        snprintf(name, sizeof(name), "%s", w->longName);
+        w->longName[0] = '\0';
+    } else if (memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+        snprintf(name, sizeof(name), "%.155s/%.100s", (const char *)h + 345, (const char *)h);
+    } else {
+        snprintf(name, sizeof(name), "%.100s", (const char *)h);
+    }
+
+    if ((type == '0' || type == '\0') && !w->wicFound && nameIsWic(name)) {
+        mfrlib_log("parseTarHeader writing '%s' of %llu bytes\n", name, (unsigned long long)w->entryRemaining);
+        w->wicFound = 1;
+        w->entryIsWic = 1;
+    }
+    w->tarState = w->entryRemaining ? TAR_STATE_DATA : TAR_STATE_PADDING;
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Consume the next bytes of the tar stream, routing the contents of the .wic entry
+ */
+static mfrError_t feedTar(imageWriter_t *w, const unsigned char *buf, size_t len)
+{
+    mfrError_t ret;
+
+    while (len > 0) {
+        size_t n;
+
+        switch (w->tarState) {
+        case TAR_STATE_HEADER:
+            n = TAR_BLOCK_SIZE - w->headerLen;
+            n = (n < len) ? n : len;
+            memcpy(w->header + w->headerLen, buf, n);
+            w->headerLen += n;
+            if (w->headerLen == TAR_BLOCK_SIZE) {
+                w->headerLen = 0;
+                if ((ret = parseTarHeader(w)) != mfrERR_NONE) {
+                    return ret;
+                }
+            }
+            break;
+
+        case TAR_STATE_DATA:
+        case TAR_STATE_META:
+            n = (w->entryRemaining < len) ? (size_t)w->entryRemaining : len;
+            if (w->tarState == TAR_STATE_META) {
+                memcpy(w->meta + w->metaLen, buf, n);
+                w->metaLen += n;
+            } else if (w->entryIsWic && (ret = feedWic(w, buf, n)) != mfrERR_NONE) {
+                return ret;
+            }
+            w->entryRemaining -= n;
+            if (w->entryRemaining == 0) {
+                if (w->tarState == TAR_STATE_META) {
+                    w->meta[w->metaLen] = '\0';
+                    if (w->metaType == 'L' && w->metaLen < sizeof(w->longName)) {
+                        memcpy(w->longName, w->meta, w->metaLen + 1);
+                    } else if (w->metaType == 'x') {
+                        parsePaxHeader(w);
+                    }
+                }
+                w->tarState = TAR_STATE_PADDING;
+            }
+            break;
+
+        case TAR_STATE_PADDING:
+            n = (w->entryPadding < len) ? (size_t)w->entryPadding : len;
+            w->entryPadding -= n;
+            if (w->entryPadding == 0) {
+                w->tarState = TAR_STATE_HEADER;
+            }
+            break;
+
+        case TAR_STATE_END:
+        default:
+            /* end-of-archive blocks and trailing padding */
+            return mfrERR_NONE;
+        }
+        buf += n;
+        len -= n;
+    }
+    return mfrERR_NONE;
+}
+
+static mfrError_t feedArchive(imageWriter_t *w, const unsigned char *buf, size_t len)
+{
+    return (w->format == IMAGE_FORMAT_WIC) ? feedWic(w, buf, len) : feedTar(w, buf, len);
+}
+
+/**
+ * @brief Inflate the next compressed bytes and pass them on; concatenated gzip members are allowed
+ */
+static mfrError_t feedGzip(imageWriter_t *w, unsigned char *buf, size_t len, unsigned char *out)
+{
+    mfrError_t ret;
+
+    w->zs.next_in = buf;
+    w->zs.avail_in = (uInt)len;
+    while (w->zs.avail_in > 0) {
+        int zret;
+
+        if (w->zsEnded) {
+            inflateReset(&w->zs);
+            w->zsEnded = 0;
+        }
+        w->zs.next_out = out;
+        w->zs.avail_out = IMAGE_INFLATE_SIZE;
+        zret = inflate(&w->zs, Z_NO_FLUSH);
+        if (zret != Z_OK && zret != Z_STREAM_END && zret != Z_BUF_ERROR) {
+            mfrlib_log("feedGzip inflate failed: %s\n", w->zs.msg ? w->zs.msg : "unknown error");
+            return mfrERR_GENERAL;
+        }
+        if ((ret = feedArchive(w, out, IMAGE_INFLATE_SIZE - w->zs.avail_out)) != mfrERR_NONE) {
+            return ret;
+        }
+        if (zret == Z_STREAM_END) {
+            w->zsEnded = 1;
+        }
+    }
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Tell the image format from its first bytes
+ */
+static mfrError_t detectFormat(imageWriter_t *w)
+{
+    unsigned char head[SECTOR_SIZE];
+    ssize_t len = pread(w->fd, head, sizeof(head), 0);
+
+    if (len >= 2 && head[0] == 0x1f && head[1] == 0x8b) {
+        w->format = IMAGE_FORMAT_TAR_GZ;
+    } else if (len == SECTOR_SIZE && memcmp(head + 257, "ustar", 5) == 0) {
+        w->format = IMAGE_FORMAT_TAR;
+    } else if (len == SECTOR_SIZE && head[510] == 0x55 && head[511] == 0xaa) {
+        w->format = IMAGE_FORMAT_WIC;
+        w->wicFound = 1;
+    } else {
+        mfrlib_log("detectFormat unsupported image format\n");
+        return mfrERR_GENERAL;
+    }
+
+    if (w->format == IMAGE_FORMAT_TAR_GZ) {
+        if (inflateInit2(&w->zs, 16 + MAX_WBITS) != Z_OK) {
+            return mfrERR_MEMORY_EXHAUSTED;
+        }
+        w->zsInitialized = 1;
+    }
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Read the image once, start to end, and write it out as it is decoded
+ */
+static mfrError_t streamImage(imageWriter_t *w)
+{
+    unsigned char *out = (w->format == IMAGE_FORMAT_TAR_GZ) ? malloc(IMAGE_INFLATE_SIZE) : NULL;
+    digestPipe_t *digest = digestPipeStart(w->sha256);
+    unsigned char *in;
+    mfrError_t ret = mfrERR_NONE;
+    ssize_t len;
+
+    w->rootfsDigest = w->readback ? digestPipeStart(0) : NULL;
+    if (!digest || (w->format == IMAGE_FORMAT_TAR_GZ && !out) || (w->readback && !w->rootfsDigest)) {
+        if (digest) {
+            digestPipeFinish(digest, NULL);
+        }
+        if (w->rootfsDigest) {
+            digestPipeFinish(w->rootfsDigest, NULL);
+            w->rootfsDigest = NULL;
+        }
+        free(out);
+        return mfrERR_MEMORY_EXHAUSTED;
+    }
+    w->imageDigest = digest;
+
+    /* the digests are computed on the hasher thread from the same buffers, as they are read */
+    while ((len = read(w->fd, (in = digestPipeAcquire(digest)), DIGEST_PIPE_BUFFER_SIZE)) != 0) {
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            mfrlib_log("streamImage read failed: %s\n", strerror(errno));
+            ret = mfrERR_IMAGE_FILE_OPEN_FAILED;
+            break;
+        }
+        digestPipeSubmit(digest, (size_t)len);
+        w->consumed += (uint64_t)len;
+        ret = (w->format == IMAGE_FORMAT_TAR_GZ) ? feedGzip(w, in, (size_t)len, out) : feedArchive(w, in, (size_t)len);
+        if (ret != mfrERR_NONE) {
+            break;
+        }
+        notifyProgress(w, mfrUPGRADE_PROGRESS_STARTED, mfrERR_NONE,
+                       (int)(w->consumed * PROGRESS_STREAM_PERCENT / (w->fileSize ? w->fileSize : 1)));
+    }
+    free(out);
+    w->imageDigest = NULL;
+    if (w->rootfsDigest) {
+        digestResult_t rootfs;
+
+        if (ret == mfrERR_NONE && w->rootfsHashBuf && w->rootfsHashLen > 0) {
+            digestPipeSubmit(w->rootfsDigest, w->rootfsHashLen);
+        }
+        if (digestPipeFinish(w->rootfsDigest, (ret == mfrERR_NONE) ? &rootfs : NULL) == 0 && ret == mfrERR_NONE) {
+            snprintf(w->rootfsMd5, sizeof(w->rootfsMd5), "%s", rootfs.md5);
+        }
+        w->rootfsDigest = NULL;
+        w->rootfsHashBuf = NULL;
+    }
+    if (ret != mfrERR_NONE) {
+        digestPipeFinish(digest, NULL);
+        return ret;
+    }
+    if (digestPipeFinish(digest, &w->digests) == -1) {
+        mfrlib_log("streamImage failed to compute the image digests\n");
+        return mfrERR_GENERAL;
+    }
+    mfrlib_log("streamImage image md5 '%s'\n", w->digests.md5);
+    if (w->sha256) {
+        mfrlib_log("streamImage image sha256 '%s'\n", w->digests.sha256);
+    }
+    /* what was written below the checkpoint came from the image the journal recorded */
+    if ((w->journalDigests.md5[0] && strcmp(w->journalDigests.md5, w->digests.md5) != 0) ||
+        (w->journalDigests.sha256[0] && w->sha256 && strcmp(w->journalDigests.sha256, w->digests.sha256) != 0)) {
+        mfrlib_log("streamImage the image is not the one the journal was written for\n");
+        dropJournal(w);
+        return mfrERR_FLASH_VERIFY_FAILED;
+    }
+
+    if (w->format == IMAGE_FORMAT_TAR_GZ && !w->zsEnded) {
+        mfrlib_log("streamImage compressed image is truncated\n");
+        return mfrERR_GENERAL;
+    }
+    if (!w->wicFound) {
+        mfrlib_log("streamImage no .wic in the archive\n");
+        return mfrERR_GENERAL;
+    }
+    for (int i = WIC_BOOT_PARTITION; i <= WIC_ROOTFS_PARTITION; i++) {
+        if (!w->partitionsParsed || w->wicOffset < w->partitions[i].start + w->partitions[i].size) {
+            mfrlib_log("streamImage .wic is truncated\n");
+            return mfrERR_GENERAL;
+        }
+    }
+
+    if (w->rootfsMode == ROOTFS_WRITE_DELTA && (ret = flushDeltaChunk(w)) != mfrERR_NONE) {
+        return ret;
+    }
+    /* a staged rootfs is only read back through a loop device; it need not reach the flash */
+    if ((w->rootfsMode != ROOTFS_WRITE_FILES && fsync(w->rootfsFd) == -1) || fsync(w->bootFd) == -1) {
+        mfrlib_log("streamImage fsync failed: %s\n", strerror(errno));
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+    mfrlib_log("streamImage rootfs %llu bytes written, %llu bytes unchanged, resumed at %llu\n",
+               (unsigned long long)w->rootfsWritten, (unsigned long long)w->rootfsUnchanged,
+               (unsigned long long)w->resumeFrom);
+    w->rootfsSize = w->partitions[WIC_ROOTFS_PARTITION].size;
+    w->checkpoint = w->wicOffset;
+    saveJournal(w, (w->stage > JOURNAL_STAGE_WRITTEN) ? w->stage : JOURNAL_STAGE_WRITTEN);
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Take the expected digest from a file beside the image, in md5sum or sha256sum format
+ * @return 0 if absent or read, -1 if the file holds no digest of the given length
+ */
+static int readDigestFile(const char *imagePath, const char *suffix, char *digest, size_t hexLen)
+{
+    char path[PATH_MAX];
+    char text[4096];
+    size_t len;
+
+    if (snprintf(path, sizeof(path), "%s%s", imagePath, suffix) >= (int)sizeof(path) ||
+        readTextFile(path, text, sizeof(text)) == -1) {
+        return 0;
+    }
+    len = strspn(text, "0123456789abcdefABCDEF");
+    if (len != hexLen || (text[len] != '\0' && !strchr(" \t\r\n", text[len]))) {
+        mfrlib_log("readDigestFile no digest in '%s'\n", path);
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        digest[i] = (char)((text[i] >= 'A' && text[i] <= 'F') ? text[i] - 'A' + 'a' : text[i]);
+    }
+    digest[len] = '\0';
+    mfrlib_log("readDigestFile expecting '%s' from '%s'\n", digest, path);
+    return 0;
+}
+
+/**
+ * @brief Pick up the digests and the detached signature supplied beside the image
+ */
+static mfrError_t readImageSidecars(imageWriter_t *w, const char *imagePath)
+{
+    char path[PATH_MAX];
+    ssize_t len;
+    int fd;
+
+    if (readDigestFile(imagePath, ".md5", w->expectedMd5, DIGEST_MD5_HEX_LEN) == -1 ||
+        readDigestFile(imagePath, ".sha256", w->expectedSha256, DIGEST_SHA256_HEX_LEN) == -1) {
+        return mfrERR_FLASH_VERIFY_FAILED;
+    }
+    if (snprintf(path, sizeof(path), "%s.sig", imagePath) >= (int)sizeof(path) ||
+        (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        return mfrERR_NONE;
+    }
+    len = read(fd, w->signature, sizeof(w->signature));
+    if (len > 0 && len <= IMAGE_SIGNATURE_MAX) {
+        w->signatureLen = (size_t)len;
+    }
+    close(fd);
+    if (w->signatureLen == 0) {
+        mfrlib_log("readImageSidecars bad signature in '%s'\n", path);
+        return mfrERR_FLASH_VERIFY_FAILED;
+    }
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Check the digests of the image, computed as it streamed, against those supplied
+ */
+static mfrError_t verifyImage(const imageWriter_t *w)
+{
+    if (w->expectedMd5[0] && strcmp(w->expectedMd5, w->digests.md5) != 0) {
+        mfrlib_log("verifyImage md5 '%s' does not match '%s'\n", w->digests.md5, w->expectedMd5);
+        return mfrERR_FLASH_VERIFY_FAILED;
+    }
+    if (w->expectedSha256[0] && strcmp(w->expectedSha256, w->digests.sha256) != 0) {
+        mfrlib_log("verifyImage sha256 '%s' does not match '%s'\n", w->digests.sha256, w->expectedSha256);
+        return mfrERR_FLASH_VERIFY_FAILED;
+    }
+    if (w->publicKey[0]) {
+        if (digestVerifySignature(w->digests.sha256, w->signature, w->signatureLen, w->publicKey) == -1) {
+            mfrlib_log("verifyImage signature does not match '%s'\n", w->publicKey);
+            return mfrERR_FLASH_VERIFY_FAILED;
+        }
+        mfrlib_log("verifyImage signature verified\n");
+    } else if (w->signatureLen > 0) {
+        mfrlib_log("verifyImage no %s configured, signature not checked\n", IMAGE_PUBLIC_KEY_KEY);
+    }
+    return mfrERR_NONE;
+}
+
+static void *readbackThreadMain(void *arg)
+{
+    imageWriter_t *w = (imageWriter_t *)arg;
+    char md5[DIGEST_MD5_HEX_LEN + 1];
+    int fd;
+
+    w->readbackResult = mfrERR_FLASH_VERIFY_FAILED;
+    /* read the flash, not the page cache; where O_DIRECT is refused, drop the cached pages instead */
+    fd = open(w->rootfsTarget, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (fd == -1 && errno == EINVAL && (fd = open(w->rootfsTarget, O_RDONLY | O_CLOEXEC)) != -1) {
+        posix_fadvise(fd, 0, (off_t)w->rootfsSize, POSIX_FADV_DONTNEED);
+    }
+    if (fd == -1 || digestFileMd5(fd, 0, w->rootfsSize, md5) == -1) {
+        mfrlib_log("readbackThreadMain failed to read back '%s': %s\n", w->rootfsTarget, strerror(errno));
+    } else if (strcmp(md5, w->rootfsMd5) != 0) {
+        mfrlib_log("readbackThreadMain '%s' reads back as '%s', written '%s'\n", w->rootfsTarget, md5, w->rootfsMd5);
+    } else {
+        mfrlib_log("readbackThreadMain '%s' verified\n", w->rootfsTarget);
+        w->readbackResult = mfrERR_NONE;
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Start reading the rootfs back from the bank, to run alongside the boot stage
+ */
+static mfrError_t startReadback(imageWriter_t *w)
+{
+    w->readbackResult = mfrERR_NONE;
+    if (!w->readback) {
+        return mfrERR_NONE;
+    }
+    if (!w->rootfsMd5[0] || w->rootfsSize == 0) {
+        mfrlib_log("startReadback no digest of the written rootfs\n");
+        return mfrERR_FLASH_VERIFY_FAILED;
+    }
+    if (pthread_create(&w->readbackThread, NULL, readbackThreadMain, w) != 0) {
+        readbackThreadMain(w);
+        return w->readbackResult;
+    }
+    w->readbackRunning = 1;
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Wait for the read-back of the rootfs and return its result
+ */
+static mfrError_t finishReadback(imageWriter_t *w)
+{
+    if (w->readbackRunning) {
+        pthread_join(w->readbackThread, NULL);
+        w->readbackRunning = 0;
+    }
+    return w->readbackResult;
+}
+
+/**
+ * @brief Mount the filesystem found at offset in an image or partition, through a free loop device
+ * @param size bytes of the image the filesystem spans, 0 for all of it
+ * @info A block device holding the filesystem from its start is mounted directly. The loop device
+ *       is released automatically when the filesystem is unmounted.
+ */
+static int mountImage(const char *image, uint64_t offset, uint64_t size, const char *mountPoint, int readOnly)
+{
+    struct loop_info64 info;
+    struct stat st;
+    char device[32];
+    char fsType[8] = "vfat";
+    unsigned char magic[2];
+    unsigned long flags = MS_NOSUID | MS_NODEV | MS_NOEXEC | (readOnly ? MS_RDONLY : 0);
+    int imageFd = -1;
+    int loopFd = -1;
+    int controlFd = -1;
+    int number;
+    int ret = -1;
+
+    imageFd = open(image, (readOnly ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+    if (imageFd == -1 || fstat(imageFd, &st) == -1) {
+        goto out;
+    }
+    /* the Pi boot partition is FAT, the rootfs ext4; tell them apart as mount(8) would */
+    if (pread(imageFd, magic, sizeof(magic), (off_t)(offset + EXT_MAGIC_OFFSET)) == sizeof(magic) &&
+        magic[0] == 0x53 && magic[1] == 0xef) {
+        strcpy(fsType, "ext4");
+    }
+    if (S_ISBLK(st.st_mode) && offset == 0 && size == 0) {
+        ret = mount(image, mountPoint, fsType, flags, NULL);
+        goto out;
+    }
+
+    controlFd = open(LOOP_CONTROL_DEVICE, O_RDWR | O_CLOEXEC);
+    if (controlFd == -1 || (number = ioctl(controlFd, LOOP_CTL_GET_FREE)) < 0) {
+        goto out;
+    }
+    snprintf(device, sizeof(device), "/dev/loop%d", number);
+    loopFd = open(device, (readOnly ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+    if (loopFd == -1 || ioctl(loopFd, LOOP_SET_FD, imageFd) == -1) {
+        goto out;
+    }
+    memset(&info, 0, sizeof(info));
+    info.lo_offset = offset;
+    info.lo_sizelimit = size;
+    info.lo_flags = LO_FLAGS_AUTOCLEAR | (readOnly ? LO_FLAGS_READ_ONLY : 0);
+    if (ioctl(loopFd, LOOP_SET_STATUS64, &info) == -1) {
+        ioctl(loopFd, LOOP_CLR_FD, 0);
+        goto out;
+    }
+    if (mount(device, mountPoint, fsType, flags, NULL) == -1) {
+        ioctl(loopFd, LOOP_CLR_FD, 0);
+        goto out;
+    }
+    ret = 0;
+
+out:
+    if (ret == -1) {
+        mfrlib_log("mountImage failed to mount '%s': %s\n", image, strerror(errno));
+    }
+    if (loopFd != -1) {
+        close(loopFd);
+    }
+    if (controlFd != -1) {
+        close(controlFd);
+    }
+    if (imageFd != -1) {
+        close(imageFd);
+    }
+    return ret;
+}
+
+/**
+ * @brief Remove everything inside a directory, keeping the directory itself
+ */
+static int removeTreeContents(int dirFd)
+{
+    DIR *dir = fdopendir(dup(dirFd));
+    struct dirent *entry;
+    int ret = 0;
+
+    if (!dir) {
+        return -1;
+    }
+    /* the duplicate shares its position with dirFd, which may have been read before */
+    rewinddir(dir);
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (entry->d_type == DT_DIR) {
+            int childFd = openat(dirFd, entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+            if (childFd == -1 || removeTreeContents(childFd) == -1) {
+                ret = -1;
+            }
+            if (childFd != -1) {
+                close(childFd);
+            }
+            if (unlinkat(dirFd, entry->d_name, AT_REMOVEDIR) == -1) {
+                ret = -1;
+            }
+        } else if (unlinkat(dirFd, entry->d_name, 0) == -1) {
+            ret = -1;
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+static int copyFileContents(int srcFd, int dstFd)
+{
+    char buf[IMAGE_COPY_SIZE];
+    uint64_t offset = 0;
+    ssize_t len;
+
+    /* in-kernel copy first; it is not available across filesystems on older kernels */
+    while ((len = copy_file_range(srcFd, NULL, dstFd, NULL, IMAGE_COPY_SIZE * 16, 0)) > 0) {
+    }
+    if (len == 0) {
+        return 0;
+    }
+    if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP) {
+        return -1;
+    }
+    while ((len = read(srcFd, buf, sizeof(buf))) > 0) {
+        if (pwriteAll(dstFd, (const unsigned char *)buf, (size_t)len, offset) == -1) {
+            return -1;
+        }
+        offset += (uint64_t)len;
+    }
+    return (len == 0) ? 0 : -1;
+}
+
+/**
+ * @brief Copy the contents of one directory into another, keeping modes and timestamps
+ * @info Ownership is not kept: the boot partition is FAT.
+ */
+static int copyTreeContents(int srcDirFd, int dstDirFd)
+{
+    DIR *dir = fdopendir(dup(srcDirFd));
+    struct dirent *entry;
+    int ret = 0;
+
+    if (!dir) {
+        return -1;
+    }
+    /* the duplicate shares its position with dirFd, which may have been read before */
+    rewinddir(dir);
+    while (ret == 0 && (entry = readdir(dir)) != NULL) {
+        struct stat st;
+        struct timespec times[2];
+        int srcFd;
+        int dstFd;
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (fstatat(srcDirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            ret = -1;
+            break;
+        }
+        times[0] = st.st_atim;
+        times[1] = st.st_mtim;
+
+        if (S_ISDIR(st.st_mode)) {
+            if (mkdirat(dstDirFd, entry->d_name, st.st_mode & 07777) == -1 && errno != EEXIST) {
+                ret = -1;
+                break;
+            }
+            srcFd = openat(srcDirFd, entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            dstFd = openat(dstDirFd, entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (srcFd == -1 || dstFd == -1 || copyTreeContents(srcFd, dstFd) == -1) {
+                ret = -1;
+            } else {
+                futimens(dstFd, times);
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            srcFd = openat(srcDirFd, entry->d_name, O_RDONLY | O_CLOEXEC);
+            dstFd = openat(dstDirFd, entry->d_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+            if (srcFd == -1 || dstFd == -1 || copyFileContents(srcFd, dstFd) == -1) {
+                ret = -1;
+            } else {
+                futimens(dstFd, times);
+            }
+        } else {
+            /* FAT holds nothing else */
+            continue;
+        }
+        if (ret == -1) {
+            mfrlib_log("copyTreeContents failed to copy '%s': %s\n", entry->d_name, strerror(errno));
+        }
+        if (srcFd != -1) {
+            close(srcFd);
+        }
+        if (dstFd != -1) {
+            close(dstFd);
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+static int openDirectory(const char *path)
+{
+    return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/**
+ * @brief Replace the files of the passive bank with those of the new rootfs
+ * @info The rootfs is mounted from the staged image, or straight from a bare .wic, and copied
+ *       with the threads of copyTree into the bank mounted read-write, keeping ownership, modes,
+ *       extended attributes and links as cp -a does.
+ */
+static mfrError_t copyRootfsFiles(const imageWriter_t *w, const char *imagePath)
+{
+    char sourcePoint[PATH_MAX];
+    char targetPoint[PATH_MAX];
+    int targetFd = -1;
+    mfrError_t ret = mfrERR_FLASH_WRITE_FAILED;
+
+    if (snprintf(sourcePoint, sizeof(sourcePoint), "%s/ota_rootfs", w->otaDir) >= (int)sizeof(sourcePoint) ||
+        snprintf(targetPoint, sizeof(targetPoint), "%s/target_rootfs", w->otaDir) >= (int)sizeof(targetPoint)) {
+        return mfrERR_INVALID_PARAM;
+    }
+    if ((mkdir(sourcePoint, 0755) == -1 && errno != EEXIST) ||
+        (mkdir(targetPoint, 0755) == -1 && errno != EEXIST)) {
+        mfrlib_log("copyRootfsFiles failed to create '%s': %s\n", w->otaDir, strerror(errno));
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+    if ((w->rootfsFd == -1)
+            ? mountImage(imagePath, w->partitions[WIC_ROOTFS_PARTITION].start, w->partitions[WIC_ROOTFS_PARTITION].size,
+                         sourcePoint, 1) == -1
+            : mountImage(w->rootfsImage, 0, 0, sourcePoint, 1) == -1) {
+        goto out;
+    }
+    if (mountImage(w->passiveBank, 0, 0, targetPoint, 0) == -1) {
+        umount(sourcePoint);
+        goto out;
+    }
+
+    targetFd = openDirectory(targetPoint);
+    if (targetFd == -1 || removeTreeContents(targetFd) == -1) {
+        mfrlib_log("copyRootfsFiles failed to empty '%s'\n", w->passiveBank);
+    } else if (copyTree(sourcePoint, targetPoint, 0) == -1 || syncfs(targetFd) == -1) {
+        mfrlib_log("copyRootfsFiles failed to copy the rootfs to '%s'\n", w->passiveBank);
+    } else {
+        ret = mfrERR_NONE;
+    }
+    if (targetFd != -1) {
+        close(targetFd);
+    }
+    umount(targetPoint);
+    umount(sourcePoint);
+
+out:
+    rmdir(targetPoint);
+    rmdir(sourcePoint);
+    return ret;
+}
+
+/**
+ * @brief Create the parent directories of a relative path under a directory
+ */
+static int makeParents(int dirFd, const char *path)
+{
+    char parent[PATH_MAX];
+
+    snprintf(parent, sizeof(parent), "%s", path);
+    for (char *slash = strchr(parent, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdirat(dirFd, parent, 0755) == -1 && errno != EEXIST) {
+            return -1;
+        }
+        *slash = '/';
+    }
+    return 0;
+}
+
+/**
+ * @brief Tell whether a file of the new boot partition has the same contents as the one in /boot
+ */
+static int bootFileUnchanged(bootUpdate_t *u, const char *path, const struct stat *newSt, const struct stat *oldSt)
+{
+    uint64_t offset = 0;
+    ssize_t len = -1;
+    int newFd;
+    int oldFd;
+
+    if (newSt->st_size != oldSt->st_size) {
+        return 0;
+    }
+    newFd = openat(u->newFd, path, O_RDONLY | O_CLOEXEC);
+    oldFd = openat(u->bootFd, path, O_RDONLY | O_CLOEXEC);
+    if (newFd != -1 && oldFd != -1) {
+        while ((len = preadAll(newFd, u->compare[0], IMAGE_COPY_SIZE, offset)) > 0) {
+            if (preadAll(oldFd, u->compare[1], IMAGE_COPY_SIZE, offset) != len ||
+                memcmp(u->compare[0], u->compare[1], (size_t)len) != 0) {
+                len = -1;
+                break;
+            }
+            offset += (uint64_t)len;
+        }
+    }
+    if (newFd != -1) {
+        close(newFd);
+    }
+    if (oldFd != -1) {
+        close(oldFd);
+    }
+    return len == 0;
+}
+
+/**
+ * @brief Copy a file or a directory tree of the new boot partition into the staging directory
+ */
+static int stageBootEntry(bootUpdate_t *u, const char *path, const struct stat *st)
+{
+    struct timespec times[2] = { st->st_atim, st->st_mtim };
+    int srcFd;
+    int dstFd;
+    int ret = -1;
+
+    if (makeParents(u->stagingFd, path) == -1) {
+        return -1;
+    }
+    if (S_ISDIR(st->st_mode)) {
+        if (mkdirat(u->stagingFd, path, st->st_mode & 07777) == -1) {
+            return -1;
+        }
+        srcFd = openat(u->newFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        dstFd = openat(u->stagingFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        ret = (srcFd == -1 || dstFd == -1) ? -1 : copyTreeContents(srcFd, dstFd);
+    } else {
+        srcFd = openat(u->newFd, path, O_RDONLY | O_CLOEXEC);
+        dstFd = openat(u->stagingFd, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st->st_mode & 07777);
+        ret = (srcFd == -1 || dstFd == -1) ? -1 : copyFileContents(srcFd, dstFd);
+    }
+    if (ret == 0) {
+        futimens(dstFd, times);
+    }
+    if (srcFd != -1) {
+        close(srcFd);
+    }
+    if (dstFd != -1) {
+        close(dstFd);
+    }
+    return ret;
+}
+
+static int addBootChange(bootUpdate_t *u, const char *path, int hasOld, int hasNew)
+{
+    if (u->count == u->capacity) {
+        size_t capacity = u->capacity ? 2 * u->capacity : 64;
+        bootChange_t *changes = realloc(u->changes, capacity * sizeof(*changes));
+        if (!changes) {
+            return -1;
+        }
+        u->changes = changes;
+        u->capacity = capacity;
+    }
+    /* the backup mirrors /boot, so the switch itself only renames */
+    if (hasOld && makeParents(u->backupFd, path) == -1) {
+        return -1;
+    }
+    if (!(u->changes[u->count].path = strdup(path))) {
+        return -1;
+    }
+    u->changes[u->count].hasOld = hasOld;
+    u->changes[u->count].hasNew = hasNew;
+    u->changes[u->count].moved = 0;
+    u->count++;
+    return 0;
+}
+
+/**
+ * @brief Compare a directory of the new boot partition with /boot, staging what differs
+ * @param path directory relative to both roots, "" for the roots themselves
+ */
+static int diffBootTree(bootUpdate_t *u, const char *path)
+{
+    const char *dirPath = path[0] ? path : ".";
+    int newDirFd = openat(u->newFd, dirPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int oldDirFd = openat(u->bootFd, dirPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = NULL;
+    struct dirent *entry;
+    int ret = -1;
+
+    if (newDirFd == -1 || oldDirFd == -1 || !(dir = fdopendir(dup(newDirFd)))) {
+        goto out;
+    }
+    rewinddir(dir);
+    ret = 0;
+    while (ret == 0 && (entry = readdir(dir)) != NULL) {
+        char child[PATH_MAX];
+        struct stat newSt;
+        struct stat oldSt;
+        int hasOld;
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (snprintf(child, sizeof(child), "%s%s%s", path, path[0] ? "/" : "", entry->d_name) >= (int)sizeof(child) ||
+            fstatat(newDirFd, entry->d_name, &newSt, AT_SYMLINK_NOFOLLOW) == -1) {
+            ret = -1;
+            break;
+        }
+        if (!S_ISDIR(newSt.st_mode) && !S_ISREG(newSt.st_mode)) {
+            /* FAT holds nothing else */
+            continue;
+        }
+        hasOld = (fstatat(oldDirFd, entry->d_name, &oldSt, AT_SYMLINK_NOFOLLOW) == 0);
+        if (hasOld && S_ISDIR(newSt.st_mode) && S_ISDIR(oldSt.st_mode)) {
+            ret = diffBootTree(u, child);
+        } else if (hasOld && S_ISREG(newSt.st_mode) && S_ISREG(oldSt.st_mode) &&
+                   bootFileUnchanged(u, child, &newSt, &oldSt)) {
+            u->unchanged++;
+        } else if (stageBootEntry(u, child, &newSt) == -1 || addBootChange(u, child, hasOld, 1) == -1) {
+            mfrlib_log("diffBootTree failed to stage '%s': %s\n", child, strerror(errno));
+            ret = -1;
+        }
+    }
+    closedir(dir);
+    if (ret == -1 || !(dir = fdopendir(dup(oldDirFd)))) {
+        ret = -1;
+        goto out;
+    }
+
+    /* whatever the new partition no longer holds goes to the backup too */
+    rewinddir(dir);
+    while (ret == 0 && (entry = readdir(dir)) != NULL) {
+        char child[PATH_MAX];
+        struct stat st;
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            (!path[0] && (strcmp(entry->d_name, BOOT_STAGING_DIR_NAME) == 0 || strcmp(entry->d_name, BOOT_BACKUP_DIR_NAME) == 0)) ||
+            fstatat(newDirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            continue;
+        }
+        if (snprintf(child, sizeof(child), "%s%s%s", path, path[0] ? "/" : "", entry->d_name) >= (int)sizeof(child) ||
+            addBootChange(u, child, 1, 0) == -1) {
+            ret = -1;
+        }
+    }
+    closedir(dir);
+
+out:
+    if (newDirFd != -1) {
+        close(newDirFd);
+    }
+    if (oldDirFd != -1) {
+        close(oldDirFd);
+    }
+    return ret;
+}
+
+/**
+ * @brief Stage cmdline.txt with root= naming the passive bank, so that the bank flips with the other renames
+ * @info The image's cmdline.txt is rewritten if it differs from /boot's and was staged, else a copy of
+ *       the current one is staged.
+ */
+static int stageBootCmdline(bootUpdate_t *u, const char *passiveBank)
+{
+    char cmdline[4096];
+    char updated[4096 + PATH_MAX];
+    const char *root;
+    size_t len;
+    int staged = 0;
+    int fd;
+    int ret;
+
+    for (size_t i = 0; i < u->count; i++) {
+        if (u->changes[i].hasNew && strcmp(u->changes[i].path, BOOT_CMDLINE_NAME) == 0) {
+            staged = 1;
+            break;
+        }
+    }
+    if (readTextFileAt(staged ? u->stagingFd : u->bootFd, BOOT_CMDLINE_NAME, cmdline, sizeof(cmdline)) == -1 ||
+        !(root = findRootArgument(cmdline, &len))) {
+        mfrlib_log("stageBootCmdline no root= argument in the %s '%s'\n", staged ? "new" : "current",
+                   BOOT_CMDLINE_NAME);
+        return -1;
+    }
+    len = (size_t)snprintf(updated, sizeof(updated), "%.*s%s%s", (int)(root - cmdline), cmdline, passiveBank,
+                           root + len);
+    fd = openat(u->stagingFd, BOOT_CMDLINE_NAME, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    ret = pwriteAll(fd, (const unsigned char *)updated, len, 0);
+    close(fd);
+    if (ret == 0 && !staged) {
+        ret = addBootChange(u, BOOT_CMDLINE_NAME, 1, 1);
+    }
+    return ret;
+}
+
+/**
+ * @brief Undo the renames of the switch, newest first
+ */
+static int rollbackBootChanges(bootUpdate_t *u)
+{
+    int ret = 0;
+
+    for (size_t i = u->count; i-- > 0;) {
+        bootChange_t *change = &u->changes[i];
+
+        if ((change->moved & BOOT_CHANGE_NEW_MOVED) &&
+            renameat(u->bootFd, change->path, u->stagingFd, change->path) == -1) {
+            ret = -1;
+        }
+        if ((change->moved & BOOT_CHANGE_OLD_MOVED) &&
+            renameat(u->backupFd, change->path, u->bootFd, change->path) == -1) {
+            mfrlib_log("rollbackBootChanges failed to restore '%s': %s\n", change->path, strerror(errno));
+            ret = -1;
+        }
+        change->moved = 0;
+    }
+    return ret;
+}
+
+/**
+ * @brief Move the old entries into the backup and the staged ones into /boot, one rename each
+ */
+static int switchBootChanges(bootUpdate_t *u)
+{
+    for (size_t i = 0; i < u->count; i++) {
+        bootChange_t *change = &u->changes[i];
+
+        if (change->hasOld) {
+            if (renameat(u->bootFd, change->path, u->backupFd, change->path) == -1) {
+                mfrlib_log("switchBootChanges failed to back up '%s': %s\n", change->path, strerror(errno));
+                return -1;
+            }
+            change->moved |= BOOT_CHANGE_OLD_MOVED;
+        }
+        if (change->hasNew) {
+            if (renameat(u->stagingFd, change->path, u->bootFd, change->path) == -1) {
+                mfrlib_log("switchBootChanges failed to install '%s': %s\n", change->path, strerror(errno));
+                return -1;
+            }
+            change->moved |= BOOT_CHANGE_NEW_MOVED;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Open a working directory inside /boot, emptied of anything an interrupted update left
+ */
+static int openBootWorkDirectory(int bootFd, const char *name)
+{
+    int fd;
+
+    if (mkdirat(bootFd, name, 0755) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    fd = openat(bootFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd != -1 && removeTreeContents(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void closeBootWorkDirectory(int bootFd, int fd, const char *name)
+{
+    if (fd != -1) {
+        removeTreeContents(fd);
+        close(fd);
+        unlinkat(bootFd, name, AT_REMOVEDIR);
+    }
+}
+
+/**
+ * @brief Bring /boot to the contents of the staged boot partition, changing only what differs
+ * @info The files that differ are staged in /boot itself, made durable with one syncfs, then
+ *       switched in with a rename each while the old ones are renamed into a backup directory
+ *       (FAT has no hardlinks). /boot is never without a complete set of files for longer than a
+ *       rename, and a failed switch is undone by renaming back. cmdline.txt is always among the
+ *       staged files, with root= naming the passive bank, so the new boot files and the bank they
+ *       boot are switched together.
+ */
+static mfrError_t updateBootPartition(imageWriter_t *w)
+{
+    bootUpdate_t u = { .bootFd = -1, .newFd = -1, .stagingFd = -1, .backupFd = -1 };
+    char mountPoint[PATH_MAX];
+    mfrError_t ret = mfrERR_FLASH_WRITE_FAILED;
+
+    if (snprintf(mountPoint, sizeof(mountPoint), "%s/ota_boot", w->otaDir) >= (int)sizeof(mountPoint)) {
+        return mfrERR_INVALID_PARAM;
+    }
+    if (mkdir(mountPoint, 0755) == -1 && errno != EEXIST) {
+        mfrlib_log("updateBootPartition failed to create '%s': %s\n", mountPoint, strerror(errno));
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+    if (mountImage(w->bootImage, 0, 0, mountPoint, 1) == -1) {
+        rmdir(mountPoint);
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+
+    u.compare[0] = malloc(IMAGE_COPY_SIZE);
+    u.compare[1] = malloc(IMAGE_COPY_SIZE);
+    if (!u.compare[0] || !u.compare[1]) {
+        ret = mfrERR_MEMORY_EXHAUSTED;
+        goto out;
+    }
+    u.bootFd = openDirectory(BOOT_DIR);
+    u.newFd = openDirectory(mountPoint);
+    if (u.bootFd == -1 || u.newFd == -1 ||
+        (u.stagingFd = openBootWorkDirectory(u.bootFd, BOOT_STAGING_DIR_NAME)) == -1 ||
+        (u.backupFd = openBootWorkDirectory(u.bootFd, BOOT_BACKUP_DIR_NAME)) == -1) {
+        mfrlib_log("updateBootPartition failed to open '%s': %s\n", BOOT_DIR, strerror(errno));
+        goto out;
+    }
+
+    /* nothing in /boot is touched until everything that changes is staged and durable */
+    if (diffBootTree(&u, "") == -1 || stageBootCmdline(&u, w->passiveBank) == -1 || syncfs(u.bootFd) == -1) {
+        mfrlib_log("updateBootPartition failed to stage the new files in '%s'\n", BOOT_DIR);
+        goto out;
+    }
+    /* the rootfs has been read back meanwhile; a bank that does not verify leaves /boot as it is */
+    if ((ret = finishReadback(w)) != mfrERR_NONE) {
+        goto out;
+    }
+    ret = mfrERR_FLASH_WRITE_FAILED;
+    if (switchBootChanges(&u) == -1 || syncfs(u.bootFd) == -1) {
+        mfrlib_log("updateBootPartition failed to update '%s'; restoring it\n", BOOT_DIR);
+        if (rollbackBootChanges(&u) == -1 || syncfs(u.bootFd) == -1) {
+            /* keep the backup for manual recovery */
+            mfrlib_log("updateBootPartition failed to restore '%s' from '%s/%s'\n", BOOT_DIR, BOOT_DIR,
+                       BOOT_BACKUP_DIR_NAME);
+            close(u.backupFd);
+            u.backupFd = -1;
+        }
+        goto out;
+    }
+    mfrlib_log("updateBootPartition %zu entries changed, %zu files unchanged\n", u.count, u.unchanged);
+    ret = mfrERR_NONE;
+
+out:
+    closeBootWorkDirectory(u.bootFd, u.backupFd, BOOT_BACKUP_DIR_NAME);
+    closeBootWorkDirectory(u.bootFd, u.stagingFd, BOOT_STAGING_DIR_NAME);
+    for (size_t i = 0; i < u.count; i++) {
+        free(u.changes[i].path);
+    }
+    free(u.changes);
+    free(u.compare[0]);
+    free(u.compare[1]);
+    if (u.newFd != -1) {
+        close(u.newFd);
+    }
+    if (u.bootFd != -1) {
+        close(u.bootFd);
+    }
+    umount(mountPoint);
+    rmdir(mountPoint);
+    return ret;
+}
+
+/**
+ * @brief Check that root= in /boot/cmdline.txt names the passive bank; updateBootPartition switched it
+ */
+static mfrError_t checkRootfsBank(const imageWriter_t *w)
+{
+    char cmdline[4096];
+    const char *root;
+    size_t len;
+
+    if (readTextFile(BOOT_CMDLINE_FILE, cmdline, sizeof(cmdline)) == -1 || !(root = findRootArgument(cmdline, &len)) ||
+        len != strlen(w->passiveBank) || strncmp(root, w->passiveBank, len) != 0) {
+        mfrlib_log("checkRootfsBank root= in '%s' does not name '%s'\n", BOOT_CMDLINE_FILE, w->passiveBank);
+        return mfrERR_FLASH_WRITE_FAILED;
+    }
+    mfrlib_log("checkRootfsBank next boot uses '%s'\n", w->passiveBank);
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Describe the image by its size, modification time and the md5 of its head
+ */
+static mfrError_t identifyImage(imageWriter_t *w, const struct stat *st)
+{
+    unsigned char *head = malloc(IMAGE_IDENTITY_SIZE);
+    char md5[DIGEST_MD5_HEX_LEN + 1];
+    ssize_t len;
+
+    if (!head) {
+        return mfrERR_MEMORY_EXHAUSTED;
+    }
+    len = preadAll(w->fd, head, IMAGE_IDENTITY_SIZE, 0);
+    if (len == -1 || digestMd5(head, (size_t)len, md5) == -1) {
+        free(head);
+        mfrlib_log("identifyImage failed to read the image\n");
+        return mfrERR_IMAGE_FILE_OPEN_FAILED;
+    }
+    free(head);
+    snprintf(w->imageIdentity, sizeof(w->imageIdentity), "%llu:%lld.%09ld:%s", (unsigned long long)st->st_size,
+             (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec, md5);
+    return mfrERR_NONE;
+}
+
+static mfrError_t writeImageFile(imageWriter_t *w, const char *imagePath)
+{
+    struct stat st;
+    mfrError_t ret;
+
+    w->fd = open(imagePath, O_RDONLY | O_CLOEXEC);
+    if (w->fd == -1 || fstat(w->fd, &st) == -1) {
+        mfrlib_log("writeImageFile failed to open '%s': %s\n", imagePath, strerror(errno));
+        return mfrERR_IMAGE_FILE_OPEN_FAILED;
+    }
+    w->fileSize = (uint64_t)st.st_size;
+    posix_fadvise(w->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if ((ret = detectFormat(w)) != mfrERR_NONE ||
+        (ret = identifyImage(w, &st)) != mfrERR_NONE ||
+        (ret = readImageSidecars(w, imagePath)) != mfrERR_NONE ||
+        (ret = findRootfsBanks(w)) != mfrERR_NONE ||
+        (ret = unmountPassiveBank(w)) != mfrERR_NONE ||
+        (ret = openTargets(w)) != mfrERR_NONE) {
+        return ret;
+    }
+
+    notifyProgress(w, mfrUPGRADE_PROGRESS_STARTED, mfrERR_NONE, 0);
+    /* streamed in full even on resume, so the digests come from the image; only writes are skipped */
+    if ((ret = streamImage(w)) != mfrERR_NONE) {
+        return ret;
+    }
+    /* nothing outside the passive bank is touched unless the image is the one supplied */
+    if ((ret = verifyImage(w)) != mfrERR_NONE || (ret = startReadback(w)) != mfrERR_NONE) {
+        return ret;
+    }
+    notifyProgress(w, mfrUPGRADE_PROGRESS_STARTED, mfrERR_NONE, PROGRESS_STREAM_PERCENT);
+    if (w->rootfsMode == ROOTFS_WRITE_FILES && w->stage < JOURNAL_STAGE_COPIED) {
+        if ((ret = copyRootfsFiles(w, imagePath)) != mfrERR_NONE) {
+            return ret;
+        }
+        saveJournal(w, JOURNAL_STAGE_COPIED);
+    }
+    if (w->stage < JOURNAL_STAGE_BOOT) {
+        if ((ret = updateBootPartition(w)) != mfrERR_NONE) {
+            return ret;
+        }
+        saveJournal(w, JOURNAL_STAGE_BOOT);
+    }
+    notifyProgress(w, mfrUPGRADE_PROGRESS_STARTED, mfrERR_NONE, PROGRESS_BOOT_PERCENT);
+    if ((ret = finishReadback(w)) != mfrERR_NONE) {
+        return ret;
+    }
+    return checkRootfsBank(w);
+}
+
+mfrError_t imageWrite(const char *name, const char *path, mfrUpgradeStatusNotify_t notify)
+{
+    imageWriter_t *w;
+    char imagePath[PATH_MAX];
+    int busy = 0;
+    mfrError_t ret;
+
+    if (snprintf(imagePath, sizeof(imagePath), "%s/%s", path, name) >= (int)sizeof(imagePath)) {
+        return mfrERR_INVALID_PARAM;
+    }
+    if (!atomic_compare_exchange_strong(&imageWriteBusy, &busy, 1)) {
+        mfrlib_log("imageWrite another image is being written\n");
+        return mfrERR_INVALID_STATE;
+    }
+    w = calloc(1, sizeof(*w));
+    if (!w) {
+        atomic_store(&imageWriteBusy, 0);
+        return mfrERR_MEMORY_EXHAUSTED;
+    }
+    w->fd = -1;
+    w->bootFd = -1;
+    w->rootfsFd = -1;
+    w->notify = notify;
+    w->lastPercent = -1;
+
+    ret = writeImageFile(w, imagePath);
+    finishReadback(w);
+    notifyProgress(w, (ret == mfrERR_NONE) ? mfrUPGRADE_PROGRESS_COMPLETED : mfrUPGRADE_PROGRESS_ABORTED, ret,
+                   (ret == mfrERR_NONE) ? 100 : (w->lastPercent > 0 ? w->lastPercent : 0));
+    mfrlib_log("imageWrite '%s' returned '%x'\n", imagePath, ret);
+
+    if (w->zsInitialized) {
+        inflateEnd(&w->zs);
+    }
+    /* a bank or image that fails verification is not resumed; the next attempt writes it all again */
+    if (ret == mfrERR_FLASH_VERIFY_FAILED && w->journaled) {
+        mfrlib_log("imageWrite verification failed, dropping the journal\n");
+        dropJournal(w);
+    }
+    /* an interrupted write keeps its journal and staged partitions, to be resumed */
+    if (ret == mfrERR_NONE && w->journaled) {
+        unlink(w->journalPath);
+    }
+    if (w->rootfsFd != -1) {
+        close(w->rootfsFd);
+        if (w->rootfsMode == ROOTFS_WRITE_FILES && (ret == mfrERR_NONE || !w->journaled)) {
+            unlink(w->rootfsImage);
+        }
+    }
+    if (w->bootFd != -1) {
+        close(w->bootFd);
+        if (ret == mfrERR_NONE || !w->journaled) {
+            unlink(w->bootImage);
+        }
+    }
+    if (w->fd != -1) {
+        close(w->fd);
+    }
+    free(w->deltaChunk);
+    free(w->deltaExisting);
+    free(w);
+    atomic_store(&imageWriteBusy, 0);
+    return ret;
+}
@@ -0,0 +1,39 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef MFRLIB_IMAGE_H
+#define MFRLIB_IMAGE_H
+
+#include <mfrTypes.h>
+
+/**
+ * @brief Flash a firmware image onto the passive rootfs bank and /boot, then switch banks
+ * @param name file name of the image
+ * @param path directory holding the image
+ * @param notify progress callback; called from the calling thread
+ * @return mfrERR_NONE when the image was written and the next boot uses the new bank
+ * @info The image is either a tar.gz (or tar) archive holding a .wic disk image, or a bare
+ *       .wic. It is decompressed and parsed as it is read: the rootfs partition is written
+ *       straight to the passive bank and only the boot partition is staged under
+ *       $PERSISTENT_PATH/ota, so no extracted copy of the image is ever stored.
+ *       Only one image is written at a time; a concurrent call returns mfrERR_INVALID_STATE.
+ */
+mfrError_t imageWrite(const char *name, const char *path, mfrUpgradeStatusNotify_t notify);
+
+#endif /* MFRLIB_IMAGE_H */
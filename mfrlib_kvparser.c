@@ -0,0 +1,300 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mfrlib_kvparser.h"
+
+#define KV_READ_CHUNK 4096
+#define KV_INITIAL_ENTRIES 32
+
+/**
+ * @brief FNV-1a hash of the given key
+ */
+static unsigned int kvHash(const char *key, size_t len)
+{
+    unsigned int hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int kvIsSpace(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\r');
+}
+
+/**
+ * @brief Read the whole file into a heap buffer
+ * @info Used for files whose size is not known up front, such as procfs entries.
+ */
+static int kvReadAll(int fd, kvFile_t *kv)
+{
+    size_t capacity = KV_READ_CHUNK;
+    size_t used = 0;
+    char *buf = malloc(capacity);
+
+    if (!buf) {
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t n;
+        if (used == capacity) {
+            char *tmp = realloc(buf, capacity * 2);
+            if (!tmp) {
+                free(buf);
+                return -1;
+            }
+            buf = tmp;
+            capacity *= 2;
+        }
+        n = read(fd, buf + used, capacity - used);
+        if (n < 0) {
+            free(buf);
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        used += (size_t)n;
+    }
+
+    kv->data = buf;
+    kv->size = used;
+    kv->mapped = 0;
+    return 0;
+}
+
+/**
+ * @brief Map or read the file contents into the parser state
+ * @param map map regular files instead of reading them; only for files that are never
+ *        truncated while loaded, as touching a mapping past the end of the file raises SIGBUS
+ */
+static int kvReadFile(const char *path, kvFile_t *kv, int map)
+{
+    struct stat st;
+    int ret = -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return ret;
+    }
+
+    if (map && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            kv->data = addr;
+            kv->size = (size_t)st.st_size;
+            kv->mapped = 1;
+            ret = 0;
+        }
+    }
+    if (ret == -1) {
+        ret = kvReadAll(fd, kv);
+    }
+
+    close(fd);
+    return ret;
+}
+
+static int kvAppendEntry(kvFile_t *kv, unsigned int *capacity, const kvEntry_t *entry)
+{
+    if (kv->count == *capacity) {
+        unsigned int newCapacity = *capacity ? (*capacity * 2) : KV_INITIAL_ENTRIES;
+        kvEntry_t *tmp = realloc(kv->entries, newCapacity * sizeof(kvEntry_t));
+        if (!tmp) {
+            return -1;
+        }
+        kv->entries = tmp;
+        *capacity = newCapacity;
+    }
+    kv->entries[kv->count++] = *entry;
+    return 0;
+}
+
+/**
+ * @brief Find the index slot of the given key
+ * @return slot holding the key, or the empty slot where it would be inserted
+ */
+static unsigned int kvFindSlot(const kvFile_t *kv, const char *key, size_t keyLen, unsigned int hash)
+{
+    unsigned int slot = hash & kv->slotMask;
+
+    while (kv->slots[slot]) {
+        const kvEntry_t *entry = &kv->entries[kv->slots[slot] - 1];
+        if (entry->hash == hash && entry->keyLen == keyLen && memcmp(entry->key, key, keyLen) == 0) {
+            break;
+        }
+        slot = (slot + 1) & kv->slotMask;
+    }
+    return slot;
+}
+
+static int kvBuildIndex(kvFile_t *kv)
+{
+    unsigned int slotCount = 16;
+    unsigned int i;
+
+    while (slotCount < kv->count * 2) {
+        slotCount <<= 1;
+    }
+    kv->slots = calloc(slotCount, sizeof(unsigned int));
+    if (!kv->slots) {
+        return -1;
+    }
+    kv->slotMask = slotCount - 1;
+
+    for (i = 0; i < kv->count; i++) {
+        const kvEntry_t *entry = &kv->entries[i];
+        unsigned int slot = kvFindSlot(kv, entry->key, entry->keyLen, entry->hash);
+        /* first occurrence of a key wins */
+        if (!kv->slots[slot]) {
+            kv->slots[slot] = i + 1;
+        }
+    }
+    return 0;
+}
+
+static int kvLoad(kvFile_t *kv, const char *path, char separator, int map)
+{
+    unsigned int capacity = 0;
+    const char *pos = NULL;
+    const char *end = NULL;
+
+    if (!kv || !path) {
+        return -1;
+    }
+
+    memset(kv, 0, sizeof(*kv));
+    if (kvReadFile(path, kv, map) == -1) {
+        return -1;
+    }
+
+    pos = kv->data;
+    end = kv->data + kv->size;
+    while (pos < end) {
+        const char *eol = memchr(pos, '\n', (size_t)(end - pos));
+        const char *lineEnd = eol ? eol : end;
+        const char *sep = NULL;
+        const char *keyEnd = NULL;
+        const char *value = NULL;
+        const char *valueEnd = NULL;
+        kvEntry_t entry;
+
+        while (pos < lineEnd && kvIsSpace(*pos)) {
+            pos++;
+        }
+        if (pos < lineEnd && *pos != '#') {
+            sep = memchr(pos, separator, (size_t)(lineEnd - pos));
+        }
+        if (sep && sep > pos) {
+            keyEnd = sep;
+            while (keyEnd > pos && kvIsSpace(keyEnd[-1])) {
+                keyEnd--;
+            }
+            value = sep + 1;
+            while (value < lineEnd && kvIsSpace(*value)) {
+                value++;
+            }
+            valueEnd = lineEnd;
+            while (valueEnd > value && kvIsSpace(valueEnd[-1])) {
+                valueEnd--;
+            }
+
+            entry.key = pos;
+            entry.keyLen = (size_t)(keyEnd - pos);
+            entry.value = value;
+            entry.valueLen = (size_t)(valueEnd - value);
+            entry.hash = kvHash(entry.key, entry.keyLen);
+            if (kvAppendEntry(kv, &capacity, &entry) == -1) {
+                kvFileRelease(kv);
+                return -1;
+            }
+        }
+        pos = eol ? eol + 1 : end;
+    }
+
+    if (kvBuildIndex(kv) == -1) {
+        kvFileRelease(kv);
+        return -1;
+    }
+    return 0;
+}
+
+int kvFileLoad(kvFile_t *kv, const char *path, char separator)
+{
+    return kvLoad(kv, path, separator, 0);
+}
+
+int kvFileMap(kvFile_t *kv, const char *path, char separator)
+{
+    return kvLoad(kv, path, separator, 1);
+}
+
+int kvFileLookup(const kvFile_t *kv, const char *key, char *valueOut, size_t size)
+{
+    const kvEntry_t *entry = NULL;
+    unsigned int slot;
+    size_t keyLen;
+    size_t len;
+
+    if (!kv || !kv->slots || !key || !valueOut || size == 0) {
+        return -1;
+    }
+
+    keyLen = strlen(key);
+    slot = kvFindSlot(kv, key, keyLen, kvHash(key, keyLen));
+    if (!kv->slots[slot]) {
+        return -1;
+    }
+
+    entry = &kv->entries[kv->slots[slot] - 1];
+    len = (entry->valueLen < size - 1) ? entry->valueLen : size - 1;
+    memcpy(valueOut, entry->value, len);
+    valueOut[len] = '\0';
+    return 0;
+}
+
+void kvFileRelease(kvFile_t *kv)
+{
+    if (!kv) {
+        return;
+    }
+
+    if (kv->data) {
+        if (kv->mapped) {
+            munmap(kv->data, kv->size);
+        } else {
+            free(kv->data);
+        }
+    }
+    free(kv->entries);
+    free(kv->slots);
+    memset(kv, 0, sizeof(*kv));
+}
@@ -0,0 +1,80 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef MFRLIB_KVPARSER_H
+#define MFRLIB_KVPARSER_H
+
+#include <stddef.h>
+
+/* One 'key<separator>value' line; both point into the file contents, not NUL terminated */
+typedef struct {
+    const char *key;
+    size_t keyLen;
+    const char *value;
+    size_t valueLen;
+    unsigned int hash;
+} kvEntry_t;
+
+/* Parsed key/value file with an exact-key hash index */
+typedef struct {
+    char *data;
+    size_t size;
+    int mapped;
+    kvEntry_t *entries;
+    unsigned int count;
+    unsigned int *slots;
+    unsigned int slotMask;
+} kvFile_t;
+
+/**
+ * @brief Parse the given file into an exact-key index in a single pass
+ * @param kv parser state to fill; release with kvFileRelease
+ * @param path file to parse
+ * @param separator character separating key and value on a line, eg '=' or ':'
+ * @return 0 on success, -1 on failure
+ * @info Blank lines, '#' comments and lines without the separator are skipped. Whitespace
+ *       around keys and values is trimmed. If a key repeats, the first occurrence wins.
+ */
+int kvFileLoad(kvFile_t *kv, const char *path, char separator);
+
+/**
+ * @brief Same as kvFileLoad, but maps regular files instead of reading them
+ * @info Only for files that do not change while the library runs, eg /etc/device.properties
+ *       and /version.txt. A file truncated while it is mapped raises SIGBUS on access, so
+ *       files rewritten at runtime, like debug.ini, must use kvFileLoad.
+ */
+int kvFileMap(kvFile_t *kv, const char *path, char separator);
+
+/**
+ * @brief Look up the value of the given key
+ * @param kv parsed file
+ * @param key exact key to look up
+ * @param valueOut output buffer to store the value; truncated to fit
+ * @param size size of the output buffer
+ * @return 0 on success, -1 if the key is not present
+ */
+int kvFileLookup(const kvFile_t *kv, const char *key, char *valueOut, size_t size);
+
+/**
+ * @brief Release the file contents and index held by the parser state
+ * @param kv parser state filled by kvFileLoad
+ */
+void kvFileRelease(kvFile_t *kv);
+
+#endif /* MFRLIB_KVPARSER_H */
@@ -0,0 +1,363 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#include "mfrlib_logger.h"
+
+#define LOGGER_RING_SIZE 256            /* power of two */
+#define LOGGER_RING_MASK (LOGGER_RING_SIZE - 1)
+#define LOGGER_TEXT_SIZE 240
+#define LOGGER_WRITE_BUF_SIZE 16384
+#define LOGGER_PREFIX_SIZE 32
+
+/*
+ * Bounded multi-producer, single-consumer ring. Each slot carries a sequence number: a slot
+ * at position pos is free for producers when seq == pos, and holds an entry for the writer
+ * thread when seq == pos + 1. Producers claim positions with a CAS on enqueuePos.
+ */
+typedef struct {
+    _Atomic size_t seq;
+    struct timespec time;
+    size_t len;
+    char text[LOGGER_TEXT_SIZE];
+} loggerEntry_t;
+
+static loggerEntry_t ring[LOGGER_RING_SIZE];
+static _Atomic size_t enqueuePos = 0;
+static _Atomic size_t dequeuePos = 0;
+static _Atomic uint64_t droppedCount = 0;
+
+static pthread_once_t loggerOnce = PTHREAD_ONCE_INIT;
+static pthread_t loggerThread;
+static atomic_int loggerRunning = 0;
+static atomic_int loggerStop = 0;
+static atomic_int loggerSleeping = 0;
+static int wakeFd = -1;
+static int outputFd = STDOUT_FILENO;
+
+/* Configuration file watched by the writer thread; see loggerWatchConfig */
+static atomic_int configFd = -1;
+static char configName[NAME_MAX + 1];
+static void (*configChanged)(void) = NULL;
+
+static void writeAll(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static void wakeWriter(void)
+{
+    uint64_t one = 1;
+
+    if (write(wakeFd, &one, sizeof(one)) != sizeof(one)) {
+        /* the writer still wakes up on its own at the next entry */
+    }
+}
+
+/**
+ * @brief Write out every entry available in the ring
+ * @return number of entries written
+ */
+static size_t drainRing(char *buf, uint64_t *droppedReported)
+{
+    size_t pos = atomic_load_explicit(&dequeuePos, memory_order_relaxed);
+    size_t used = 0;
+    size_t drained = 0;
+    uint64_t dropped;
+
+    for (;;) {
+        loggerEntry_t *entry = &ring[pos & LOGGER_RING_MASK];
+        struct tm tm;
+
+        if (atomic_load_explicit(&entry->seq, memory_order_acquire) != pos + 1) {
+            break;
+        }
+        if (used + LOGGER_PREFIX_SIZE + entry->len > LOGGER_WRITE_BUF_SIZE) {
+            writeAll(outputFd, buf, used);
+            used = 0;
+        }
+        localtime_r(&entry->time.tv_sec, &tm);
+        used += (size_t)snprintf(buf + used, LOGGER_PREFIX_SIZE, "%02d%02d%02d-%02d:%02d:%02d.%06ld ",
+                                 tm.tm_year % 100, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                                 entry->time.tv_nsec / 1000);
+        memcpy(buf + used, entry->text, entry->len);
+        used += entry->len;
+
+        /* hand the slot back to the producers */
+        atomic_store_explicit(&entry->seq, pos + LOGGER_RING_SIZE, memory_order_release);
+        pos++;
+        drained++;
+    }
+
+    dropped = atomic_load_explicit(&droppedCount, memory_order_relaxed);
+    if (dropped != *droppedReported && used + 64 <= LOGGER_WRITE_BUF_SIZE) {
+        used += (size_t)snprintf(buf + used, 64, "mfrlib: %llu log entries dropped\n",
+                                 (unsigned long long)(dropped - *droppedReported));
+        *droppedReported = dropped;
+    }
+    if (used > 0) {
+        writeAll(outputFd, buf, used);
+    }
+
+    atomic_store_explicit(&dequeuePos, pos, memory_order_release);
+    return drained;
+}
+
+static int ringIsEmpty(void)
+{
+    size_t pos = atomic_load_explicit(&dequeuePos, memory_order_relaxed);
+
+    return atomic_load_explicit(&ring[pos & LOGGER_RING_MASK].seq, memory_order_acquire) != pos + 1;
+}
+
+/**
+ * @brief Read the pending inotify events
+ * @return 1 if one of them is about the watched configuration file, 0 otherwise
+ */
+static int readConfigEvents(int fd)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t len;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (char *pos = buf; pos < buf + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)pos;
+            if (event->len > 0 && strcmp(event->name, configName) == 0) {
+                changed = 1;
+            }
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+static void *loggerThreadMain(void *arg)
+{
+    static char buf[LOGGER_WRITE_BUF_SIZE];
+    struct pollfd pfd[2] = {
+        { .fd = wakeFd, .events = POLLIN },
+        { .fd = -1, .events = POLLIN },
+    };
+    uint64_t droppedReported = 0;
+    uint64_t wakeups;
+
+    (void)arg;
+    for (;;) {
+        if (drainRing(buf, &droppedReported) > 0) {
+            continue;
+        }
+        if (atomic_load_explicit(&loggerStop, memory_order_acquire)) {
+            break;
+        }
+
+        /* announce the sleep, then check again so a racing producer is never missed */
+        atomic_store(&loggerSleeping, 1);
+        if (!ringIsEmpty() || atomic_load(&loggerStop)) {
+            atomic_store(&loggerSleeping, 0);
+            continue;
+        }
+        pfd[1].fd = atomic_load_explicit(&configFd, memory_order_acquire);
+        if (poll(pfd, 2, -1) > 0) {
+            if ((pfd[0].revents & POLLIN) && read(wakeFd, &wakeups, sizeof(wakeups)) != sizeof(wakeups)) {
+                /* nothing pending; drain anyway */
+            }
+            if ((pfd[1].revents & POLLIN) && readConfigEvents(pfd[1].fd)) {
+                configChanged();
+            }
+        }
+        atomic_store(&loggerSleeping, 0);
+    }
+    drainRing(buf, &droppedReported);
+    return NULL;
+}
+
+static void loggerStart(void)
+{
+    const char *path = getenv(LOGGER_FILE_ENV);
+
+    for (size_t i = 0; i < LOGGER_RING_SIZE; i++) {
+        atomic_init(&ring[i].seq, i);
+    }
+
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeFd == -1) {
+        return;
+    }
+    if (path && *path) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd != -1) {
+            outputFd = fd;
+        }
+    }
+    if (pthread_create(&loggerThread, NULL, loggerThreadMain, NULL) != 0) {
+        close(wakeFd);
+        wakeFd = -1;
+        return;
+    }
+    atomic_store_explicit(&loggerRunning, 1, memory_order_release);
+}
+
+/**
+ * @brief Stop the writer thread and write out what is left when the library is unloaded
+ */
+__attribute__((destructor)) static void loggerShutdown(void)
+{
+    if (!atomic_load_explicit(&loggerRunning, memory_order_acquire)) {
+        return;
+    }
+    atomic_store(&loggerStop, 1);
+    wakeWriter();
+    pthread_join(loggerThread, NULL);
+    atomic_store_explicit(&loggerRunning, 0, memory_order_release);
+
+    close(wakeFd);
+    if (atomic_load(&configFd) != -1) {
+        close(atomic_load(&configFd));
+    }
+    if (outputFd != STDOUT_FILENO) {
+        close(outputFd);
+    }
+}
+
+void loggerWrite(const char *format, va_list args)
+{
+    loggerEntry_t *entry = NULL;
+    size_t pos;
+    int len;
+
+    pthread_once(&loggerOnce, loggerStart);
+    if (!atomic_load_explicit(&loggerRunning, memory_order_acquire)) {
+        /* no writer thread could be started; log synchronously */
+        vfprintf(stdout, format, args);
+        return;
+    }
+
+    pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+    for (;;) {
+        size_t seq;
+        entry = &ring[pos & LOGGER_RING_MASK];
+        seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&enqueuePos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if ((intptr_t)(seq - pos) < 0) {
+            /* full; never make the caller wait for the console */
+            atomic_fetch_add_explicit(&droppedCount, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &entry->time);
+    len = vsnprintf(entry->text, sizeof(entry->text), format, args);
+    if (len < 0) {
+        len = 0;
+    } else if ((size_t)len >= sizeof(entry->text)) {
+        /* truncated; keep the line terminated */
+        len = sizeof(entry->text) - 1;
+        entry->text[len - 1] = '\n';
+    }
+    entry->len = (size_t)len;
+    atomic_store_explicit(&entry->seq, pos + 1, memory_order_release);
+
+    if (atomic_exchange(&loggerSleeping, 0)) {
+        wakeWriter();
+    }
+}
+
+void loggerFlush(void)
+{
+    size_t target = atomic_load_explicit(&enqueuePos, memory_order_acquire);
+    const struct timespec pause = { 0, 1000000 };
+
+    if (!atomic_load_explicit(&loggerRunning, memory_order_acquire)) {
+        return;
+    }
+    while (atomic_load_explicit(&dequeuePos, memory_order_acquire) < target) {
+        wakeWriter();
+        nanosleep(&pause, NULL);
+    }
+}
+
+int loggerWatchConfig(const char *path, void (*onChange)(void))
+{
+    char dir[PATH_MAX];
+    const char *name = strrchr(path, '/');
+    int fd;
+
+    if (!name || !onChange || strlen(name + 1) >= sizeof(configName)) {
+        return -1;
+    }
+    pthread_once(&loggerOnce, loggerStart);
+    if (!atomic_load_explicit(&loggerRunning, memory_order_acquire)) {
+        return -1;
+    }
+    if (atomic_load(&configFd) != -1) {
+        return 0;
+    }
+
+    /* watch the directory, so the file may be created later or replaced by a rename */
+    snprintf(dir, sizeof(dir), "%.*s", (int)(name - path), path);
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (inotify_add_watch(fd, dir[0] ? dir : "/", IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) == -1) {
+        close(fd);
+        return -1;
+    }
+    strcpy(configName, name + 1);
+    configChanged = onChange;
+    atomic_store_explicit(&configFd, fd, memory_order_release);
+    wakeWriter();
+    return 0;
+}
+
+uint64_t loggerDroppedCount(void)
+{
+    return atomic_load_explicit(&droppedCount, memory_order_relaxed);
+}
@@ -0,0 +1,63 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef MFRLIB_LOGGER_H
+#define MFRLIB_LOGGER_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+/* Environment variable naming a file the log is appended to; stdout when unset */
+#define LOGGER_FILE_ENV "MFRLIB_LOG_FILE"
+
+/**
+ * @brief Log a message when debug is enabled for LOG.RDK.MFRMGR in debug.ini
+ * @info Defined in mfrlibs_rpi.c, which owns the debug.ini configuration.
+ */
+void mfrlib_log(const char *format, ...);
+
+/**
+ * @brief Queue one formatted log entry for the background writer
+ * @param format printf style format
+ * @param args arguments of the format
+ * @info Never blocks: the entry is formatted straight into a ring buffer slot, and is dropped
+ *       and counted when the ring is full. The writer thread is started on first use.
+ */
+void loggerWrite(const char *format, va_list args);
+
+/**
+ * @brief Wait until every entry queued so far has been written out
+ */
+void loggerFlush(void);
+
+/**
+ * @brief Watch a configuration file from the writer thread
+ * @param path absolute path of the file; it does not have to exist yet
+ * @param onChange called on the writer thread whenever the file is written, replaced or removed
+ * @return 0 on success, -1 on failure
+ * @info Only the first call installs a watch; later calls return 0.
+ */
+int loggerWatchConfig(const char *path, void (*onChange)(void));
+
+/**
+ * @brief Number of entries dropped because the ring buffer was full
+ */
+uint64_t loggerDroppedCount(void);
+
+#endif /* MFRLIB_LOGGER_H */
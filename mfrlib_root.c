@@ -0,0 +1,64 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mfrlib_root.h"
+
+#ifdef MFRLIB_ROOT_SUPPORT
+static pthread_once_t rootOnce = PTHREAD_ONCE_INIT;
+static char rootDir[PATH_MAX];
+
+static void loadRootDir(void)
+{
+    const char *root = secure_getenv(MFRLIB_ROOT_ENV);
+    size_t len;
+
+    if (!root || strlen(root) >= sizeof(rootDir)) {
+        return;
+    }
+    strcpy(rootDir, root);
+    len = strlen(rootDir);
+    while (len > 0 && rootDir[len - 1] == '/') {
+        rootDir[--len] = '\0';
+    }
+}
+
+const char *rootedPath(const char *path, char *buf, size_t size)
+{
+    pthread_once(&rootOnce, loadRootDir);
+    if (rootDir[0] == '\0') {
+        return path;
+    }
+    snprintf(buf, size, "%s%s", rootDir, path);
+    return buf;
+}
+#else
+const char *rootedPath(const char *path, char *buf, size_t size)
+{
+    (void)buf;
+    (void)size;
+    return path;
+}
+#endif /* MFRLIB_ROOT_SUPPORT */
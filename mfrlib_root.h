@@ -0,0 +1,42 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef MFRLIB_ROOT_H
+#define MFRLIB_ROOT_H
+
+#include <stddef.h>
+
+/*
+ * Environment variable naming a directory every absolute path of the library is resolved
+ * under, eg a fixture tree holding etc/device.properties and sys/class/thermal. It is read
+ * once, on first use, and only by builds with MFRLIB_ROOT_SUPPORT defined, which is the
+ * copy of the library linked into mfrHalBench. The image writer never uses it.
+ */
+#define MFRLIB_ROOT_ENV "MFRLIB_ROOT"
+
+/**
+ * @brief Resolve an absolute path under the MFRLIB_ROOT directory
+ * @param path absolute path, eg "/etc/device.properties"
+ * @param buf buffer receiving the prefixed path
+ * @param size size of buf
+ * @return path itself when MFRLIB_ROOT is not set or not supported, buf otherwise
+ */
+const char *rootedPath(const char *path, char *buf, size_t size);
+
+#endif /* MFRLIB_ROOT_H */
@@ -0,0 +1,144 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include "mfrlib_stats.h"
+
+/*
+ * Counters are updated with relaxed atomic adds from any thread and never take a lock.
+ * A reader may see a call counted in calls but not yet in its latency bucket; the skew
+ * is at most the number of calls in flight.
+ */
+typedef struct {
+    _Atomic uint64_t calls;
+    _Atomic uint64_t errors;
+    _Atomic uint64_t cacheHits;
+    _Atomic uint64_t totalNs;
+    _Atomic uint64_t maxNs;
+    _Atomic uint64_t latency[MFR_STATS_LATENCY_BUCKETS];
+} statsCounters_t;
+
+static statsCounters_t apiStats[mfrSTATS_API_MAX];
+static statsCounters_t serializedTypeStats[mfrSERIALIZED_TYPE_MAX];
+
+uint64_t statsNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Log2 bucket of a latency: bucket i holds [2^i, 2^(i+1)) ns, the last one is open
+ */
+static unsigned int latencyBucket(uint64_t ns)
+{
+    unsigned int bucket;
+
+    if (ns < 2) {
+        return 0;
+    }
+    bucket = 63 - (unsigned int)__builtin_clzll(ns);
+    return (bucket < MFR_STATS_LATENCY_BUCKETS) ? bucket : MFR_STATS_LATENCY_BUCKETS - 1;
+}
+
+static void recordCall(statsCounters_t *counters, uint64_t startNs, mfrError_t status, int cacheHit)
+{
+    uint64_t ns = statsNow() - startNs;
+    uint64_t max = atomic_load_explicit(&counters->maxNs, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&counters->calls, 1, memory_order_relaxed);
+    if (status != mfrERR_NONE) {
+        atomic_fetch_add_explicit(&counters->errors, 1, memory_order_relaxed);
+    }
+    if (cacheHit) {
+        atomic_fetch_add_explicit(&counters->cacheHits, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&counters->totalNs, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->latency[latencyBucket(ns)], 1, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&counters->maxNs, &max, ns,
+                                                              memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static void readCounters(statsCounters_t *counters, mfrStatsCounters_t *stats)
+{
+    stats->calls = atomic_load_explicit(&counters->calls, memory_order_relaxed);
+    stats->errors = atomic_load_explicit(&counters->errors, memory_order_relaxed);
+    stats->cacheHits = atomic_load_explicit(&counters->cacheHits, memory_order_relaxed);
+    stats->totalNs = atomic_load_explicit(&counters->totalNs, memory_order_relaxed);
+    stats->maxNs = atomic_load_explicit(&counters->maxNs, memory_order_relaxed);
+    for (int i = 0; i < MFR_STATS_LATENCY_BUCKETS; i++) {
+        stats->latency[i] = atomic_load_explicit(&counters->latency[i], memory_order_relaxed);
+    }
+}
+
+static void resetCounters(statsCounters_t *counters)
+{
+    atomic_store_explicit(&counters->calls, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->errors, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->cacheHits, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->totalNs, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->maxNs, 0, memory_order_relaxed);
+    for (int i = 0; i < MFR_STATS_LATENCY_BUCKETS; i++) {
+        atomic_store_explicit(&counters->latency[i], 0, memory_order_relaxed);
+    }
+}
+
+void statsRecordApi(mfrStatsApi_t api, uint64_t startNs, mfrError_t status, int cacheHit)
+{
+    recordCall(&apiStats[api], startNs, status, cacheHit);
+}
+
+void statsRecordSerializedType(mfrSerializedType_t type, uint64_t startNs, mfrError_t status, int cacheHit)
+{
+    recordCall(&serializedTypeStats[type], startNs, status, cacheHit);
+}
+
+mfrError_t mfrGetApiStats(mfrStatsApi_t api, mfrStatsCounters_t *stats)
+{
+    if (api >= mfrSTATS_API_MAX || !stats) {
+        return mfrERR_INVALID_PARAM;
+    }
+    readCounters(&apiStats[api], stats);
+    return mfrERR_NONE;
+}
+
+mfrError_t mfrGetSerializedTypeStats(mfrSerializedType_t type, mfrStatsCounters_t *stats)
+{
+    if (type >= mfrSERIALIZED_TYPE_MAX || !stats) {
+        return mfrERR_INVALID_PARAM;
+    }
+    readCounters(&serializedTypeStats[type], stats);
+    return mfrERR_NONE;
+}
+
+void mfrResetStats(void)
+{
+    for (int i = 0; i < mfrSTATS_API_MAX; i++) {
+        resetCounters(&apiStats[i]);
+    }
+    for (int i = 0; i < mfrSERIALIZED_TYPE_MAX; i++) {
+        resetCounters(&serializedTypeStats[i]);
+    }
+}
@@ -0,0 +1,46 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef MFRLIB_STATS_H
+#define MFRLIB_STATS_H
+
+#include <stdint.h>
+
+#include "mfrlibs_rpi.h"
+
+/**
+ * @brief CLOCK_MONOTONIC time in nanoseconds, for the start of a measured call
+ */
+uint64_t statsNow(void);
+
+/**
+ * @brief Account one call of an entry point
+ * @param api entry point that was called
+ * @param startNs statsNow() taken when the call started
+ * @param status error code returned by the call
+ * @param cacheHit 1 if the call was served from memory without reading its source
+ */
+void statsRecordApi(mfrStatsApi_t api, uint64_t startNs, mfrError_t status, int cacheHit);
+
+/**
+ * @brief Account one read of a serialized data type, as for statsRecordApi
+ */
+void statsRecordSerializedType(mfrSerializedType_t type, uint64_t startNs, mfrError_t status, int cacheHit);
+
+#endif /* MFRLIB_STATS_H */
@@ -17,12 +17,17 @@
  * limitations under the License.
 */
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "mfrTypes.h"
+#include "mfrlibs_rpi.h"
 
 /* Keep order matching with mfrSerializedType_t from mfrTypes.h */
 const char* mfrSerializedTypeString[] = {
@@ -68,6 +73,21 @@ const char* mfrSerializedTypeString[] = {
     NULL
 };
 
+/* Keep order matching with mfrStatsApi_t from mfrlibs_rpi.h */
+const char* mfrStatsApiString[] = {
+    "mfr_init",
+    "mfr_term",
+    "mfrGetSerializedData",
+    "mfrGetSerializedDataToBuffer",
+    "mfrGetSerializedDataBatch",
+    "mfrWriteImage",
+    "mfrGetTemperature",
+    "mfrGetTemperatureZones",
+    "mfrSetTempThresholds",
+    "mfrGetTempThresholds",
+    NULL
+};
+
 mfrSerializedType_t getmfrSerializedTypeFromString(char *pString)
 {
     mfrSerializedType_t i;
@@ -84,10 +104,28 @@ mfrSerializedType_t getmfrSerializedTypeFromString(char *pString)
 
 void showUsage(const char *progName)
 {
-    printf("Usage: %s [-r serializedTypeString ]\n"
+    printf("Usage: %s [-r serializedTypeString ] [-a] [-j] [-s]\n"
+           "       %s -w seconds [-t target,...] [-n threads] [-f callsPerSecond] [-i seconds] [-s]\n"
            "\t-a: Read each type of serialized data one by one.\n"
+           "\t-j: Read every type of serialized data in one session and print it as JSON, with\n"
+           "\t    the error code and the time in microseconds spent resolving each field.\n"
+           "\t-s: Print call counters and latencies of the calls made by this run;\n"
+           "\t    reads each type of serialized data once if no other option is given.\n"
+           "\t-w seconds: Call the targets repeatedly for the given duration and report ops/s,\n"
+           "\t    latency percentiles and the temperature every interval.\n"
+           "\t\t-t target,...: serializedTypeStrings%s to call, in turn;\n"
+           "\t\t    default: every serialized data type\n"
+           "\t\t-n threads: number of calling threads (default 1)\n"
+           "\t\t-f callsPerSecond: call rate of each thread; 0 calls flat-out (default 0)\n"
+           "\t\t-i seconds: report interval (default 1)\n"
            "\t-r serializedTypeString: Read the serialized data of the given type\n"
-           "\t\t type: ", progName);
+           "\t\t type: ", progName, progName,
+#ifdef THERMAL_PROTECTION_ENABLED
+           " and 'temperature'"
+#else
+           ""
+#endif
+           );
     for (mfrSerializedType_t i = mfrSERIALIZED_TYPE_MANUFACTURER; mfrSerializedTypeString[i]; i++) {
         printf("%s ", mfrSerializedTypeString[i]);
         if (i && !(i % 5)) {
@@ -116,12 +154,503 @@ void printSerializedData(mfrSerializedType_t type)
     printf("mfr_term returned '%x'\n", mfr_term());
 }
 
+/**
+ * @brief Upper bound in microseconds of the latency below which pct percent of the calls fall
+ */
+double getLatencyPercentile(const mfrStatsCounters_t *stats, double pct)
+{
+    unsigned long long target = (unsigned long long)(stats->calls * pct / 100.0 + 0.5);
+    unsigned long long seen = 0;
+
+    for (int i = 0; i < MFR_STATS_LATENCY_BUCKETS; i++) {
+        seen += stats->latency[i];
+        if (seen >= target && seen > 0) {
+            unsigned long long bound = 2ULL << i;
+            return (double)(bound < stats->maxNs ? bound : stats->maxNs) / 1000.0;
+        }
+    }
+    return (double)stats->maxNs / 1000.0;
+}
+
+void printStatsLine(const char *name, const mfrStatsCounters_t *stats)
+{
+    if (stats->calls == 0) {
+        return;
+    }
+    printf("%-30s %8llu %8llu %8llu %10.1f %10.1f %10.1f %10.1f\n", name, stats->calls, stats->errors,
+           stats->cacheHits, (double)stats->totalNs / stats->calls / 1000.0,
+           getLatencyPercentile(stats, 50.0), getLatencyPercentile(stats, 99.0), (double)stats->maxNs / 1000.0);
+}
+
+void printStats(void)
+{
+    mfrStatsCounters_t stats;
+    const char *header = "%-30s %8s %8s %8s %10s %10s %10s %10s\n";
+
+    printf("Latencies in microseconds; p50/p99 are log2 histogram bucket bounds.\n");
+    printf(header, "api", "calls", "errors", "hits", "avg", "p50", "p99", "max");
+    for (int i = 0; mfrStatsApiString[i]; i++) {
+        if (mfrGetApiStats((mfrStatsApi_t)i, &stats) == mfrERR_NONE) {
+            printStatsLine(mfrStatsApiString[i], &stats);
+        }
+    }
+    printf("\n");
+    printf(header, "serialized type", "reads", "errors", "hits", "avg", "p50", "p99", "max");
+    for (mfrSerializedType_t i = mfrSERIALIZED_TYPE_MANUFACTURER; mfrSerializedTypeString[i]; i++) {
+        if (mfrGetSerializedTypeStats(i, &stats) == mfrERR_NONE) {
+            printStatsLine(mfrSerializedTypeString[i], &stats);
+        }
+    }
+}
+
+void readAllSerializedData(void)
+{
+    mfrSerializedData_t mfrSerializedData;
+
+    mfr_init();
+    for (mfrSerializedType_t i = mfrSERIALIZED_TYPE_MANUFACTURER; mfrSerializedTypeString[i]; i++) {
+        memset(&mfrSerializedData, 0, sizeof(mfrSerializedData));
+        if (mfrGetSerializedData(i, &mfrSerializedData) == mfrERR_NONE && mfrSerializedData.freeBuf) {
+            mfrSerializedData.freeBuf(mfrSerializedData.buf);
+        }
+    }
+    mfr_term();
+}
+
+double getElapsedUs(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+void printJsonString(const char *str)
+{
+    putchar('"');
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            printf("\\%c", *p);
+        } else if (*p < 0x20) {
+            printf("\\u%04x", *p);
+        } else {
+            putchar(*p);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Read every type with one mfr_init, one batch read and one mfr_term, and print JSON
+ * @info The latency of a field is the time the library spent resolving it in this session:
+ *       the read from its source at mfr_init plus the batch lookup.
+ */
+int dumpSerializedDataJson(void)
+{
+    mfrSerializedType_t types[mfrSERIALIZED_TYPE_MAX];
+    mfrSerializedData_t data[mfrSERIALIZED_TYPE_MAX];
+    mfrError_t status[mfrSERIALIZED_TYPE_MAX];
+    unsigned long long startNs[mfrSERIALIZED_TYPE_MAX];
+    mfrSerializedBatch_t batch = {0};
+    mfrStatsCounters_t stats;
+    struct timespec start;
+    mfrError_t initRet, batchRet, termRet;
+    double initUs, batchUs, termUs;
+    size_t count = 0;
+
+    for (mfrSerializedType_t i = mfrSERIALIZED_TYPE_MANUFACTURER; mfrSerializedTypeString[i]; i++) {
+        types[count] = i;
+        startNs[count] = (mfrGetSerializedTypeStats(i, &stats) == mfrERR_NONE) ? stats.totalNs : 0;
+        count++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    initRet = mfr_init();
+    initUs = getElapsedUs(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    batchRet = mfrGetSerializedDataBatch(types, count, data, status, &batch);
+    batchUs = getElapsedUs(&start);
+
+    printf("{\n  \"init\": { \"error\": %d, \"latencyUs\": %.1f },\n", initRet, initUs);
+    printf("  \"batch\": { \"error\": %d, \"latencyUs\": %.1f },\n", batchRet, batchUs);
+    printf("  \"fields\": [\n");
+    for (size_t i = 0; i < count; i++) {
+        mfrError_t fieldRet = (batchRet == mfrERR_NONE) ? status[i] : batchRet;
+        double fieldUs = 0;
+        if (mfrGetSerializedTypeStats(types[i], &stats) == mfrERR_NONE) {
+            fieldUs = (stats.totalNs - startNs[i]) / 1e3;
+        }
+        printf("    { \"type\": \"%s\", \"value\": ", mfrSerializedTypeString[types[i]]);
+        if (fieldRet == mfrERR_NONE) {
+            printJsonString(data[i].buf);
+        } else {
+            printf("null");
+        }
+        printf(", \"error\": %d, \"latencyUs\": %.1f }%s\n", fieldRet, fieldUs, (i + 1 < count) ? "," : "");
+    }
+    if (batch.freeArena) {
+        batch.freeArena(batch.arena);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    termRet = mfr_term();
+    termUs = getElapsedUs(&start);
+    printf("  ],\n  \"term\": { \"error\": %d, \"latencyUs\": %.1f }\n}\n", termRet, termUs);
+
+    return (initRet == mfrERR_NONE && batchRet == mfrERR_NONE) ? 0 : -1;
+}
+
+/*
+ * Watch/stress mode: worker threads call the targets in turn, at a fixed rate or flat-out,
+ * and record their latencies in per-thread histograms. The main thread reports the interval
+ * deltas of the histograms.
+ */
+#define WATCH_MAX_THREADS 64
+#define WATCH_TARGET_TEMPERATURE mfrSERIALIZED_TYPE_MAX
+#define WATCH_MAX_TARGETS (mfrSERIALIZED_TYPE_MAX + 1)
+/* log-linear buckets: 8 per power of two, below 8ns one per ns */
+#define WATCH_HIST_BUCKETS 320
+
+typedef struct {
+    _Atomic uint64_t calls;
+    _Atomic uint64_t errors;
+    _Atomic uint64_t hist[WATCH_HIST_BUCKETS];
+} watchCounters_t;
+
+typedef struct watchConfig watchConfig_t;
+
+typedef struct {
+    pthread_t tid;
+    watchConfig_t *config;
+    int first;                              /* target index the thread starts at */
+    watchCounters_t counters[WATCH_MAX_TARGETS];
+} watchThread_t;
+
+struct watchConfig {
+    int targets[WATCH_MAX_TARGETS];         /* mfrSerializedType_t or WATCH_TARGET_TEMPERATURE */
+    int targetCount;
+    int threadCount;
+    unsigned int rate;
+    atomic_int stop;
+    watchThread_t *threads;
+};
+
+typedef struct {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t hist[WATCH_HIST_BUCKETS];
+} watchTotals_t;
+
+static uint64_t watchNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int watchBucket(uint64_t ns)
+{
+    int e;
+    int idx;
+
+    if (ns < 8) {
+        return (int)ns;
+    }
+    e = 63 - __builtin_clzll(ns);
+    idx = (e - 2) * 8 + (int)((ns >> (e - 3)) & 7);
+    return (idx < WATCH_HIST_BUCKETS) ? idx : WATCH_HIST_BUCKETS - 1;
+}
+
+/* upper bound of a bucket in nanoseconds */
+static double watchBucketBound(int idx)
+{
+    if (idx < 8) {
+        return idx + 1;
+    }
+    return (double)((uint64_t)(8 + idx % 8 + 1) << (idx / 8 - 1));
+}
+
+static double watchPercentileUs(const watchTotals_t *totals, double pct)
+{
+    uint64_t target = (uint64_t)(totals->calls * pct / 100.0 + 0.5);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < WATCH_HIST_BUCKETS; i++) {
+        seen += totals->hist[i];
+        if (seen >= target && seen > 0) {
+            return watchBucketBound(i) / 1000.0;
+        }
+    }
+    return 0;
+}
+
+static double watchMaxUs(const watchTotals_t *totals)
+{
+    for (int i = WATCH_HIST_BUCKETS - 1; i >= 0; i--) {
+        if (totals->hist[i]) {
+            return watchBucketBound(i) / 1000.0;
+        }
+    }
+    return 0;
+}
+
+static mfrError_t watchCall(int target)
+{
+    mfrError_t ret = mfrERR_OPERATION_NOT_SUPPORTED;
+
+    if (target == WATCH_TARGET_TEMPERATURE) {
+#ifdef THERMAL_PROTECTION_ENABLED
+        mfrTemperatureState_t state;
+        int temperature;
+        int wifiTemperature;
+        ret = mfrGetTemperature(&state, &temperature, &wifiTemperature);
+#endif
+    } else {
+        mfrSerializedData_t data = {0};
+        ret = mfrGetSerializedData((mfrSerializedType_t)target, &data);
+        if (ret == mfrERR_NONE && data.freeBuf) {
+            data.freeBuf(data.buf);
+        }
+    }
+    return ret;
+}
+
+static void *watchThreadMain(void *arg)
+{
+    watchThread_t *self = (watchThread_t *)arg;
+    watchConfig_t *config = self->config;
+    struct timespec next;
+    long periodNs = config->rate ? (long)(1000000000L / config->rate) : 0;
+    int target = self->first;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!atomic_load_explicit(&config->stop, memory_order_relaxed)) {
+        watchCounters_t *counters = &self->counters[target];
+        uint64_t start = watchNowNs();
+        mfrError_t ret = watchCall(config->targets[target]);
+        uint64_t ns = watchNowNs() - start;
+
+        atomic_fetch_add_explicit(&counters->calls, 1, memory_order_relaxed);
+        if (ret != mfrERR_NONE) {
+            atomic_fetch_add_explicit(&counters->errors, 1, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&counters->hist[watchBucket(ns)], 1, memory_order_relaxed);
+        target = (target + 1) % config->targetCount;
+
+        if (periodNs) {
+            next.tv_nsec += periodNs;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Sum the counters of every thread for one target, or for all targets if target is -1
+ */
+static void watchCollect(const watchConfig_t *config, int target, watchTotals_t *totals)
+{
+    memset(totals, 0, sizeof(*totals));
+    for (int t = 0; t < config->threadCount; t++) {
+        for (int i = 0; i < config->targetCount; i++) {
+            watchCounters_t *counters = &config->threads[t].counters[i];
+            if (target != -1 && target != i) {
+                continue;
+            }
+            totals->calls += atomic_load_explicit(&counters->calls, memory_order_relaxed);
+            totals->errors += atomic_load_explicit(&counters->errors, memory_order_relaxed);
+            for (int b = 0; b < WATCH_HIST_BUCKETS; b++) {
+                totals->hist[b] += atomic_load_explicit(&counters->hist[b], memory_order_relaxed);
+            }
+        }
+    }
+}
+
+static void watchPrintTemperature(void)
+{
+#ifdef THERMAL_PROTECTION_ENABLED
+    mfrTemperatureState_t state;
+    int temperature;
+    int wifiTemperature;
+
+    if (mfrGetTemperature(&state, &temperature, &wifiTemperature) == mfrERR_NONE) {
+        printf(" %7d %7d %5d", temperature, wifiTemperature, state);
+        return;
+    }
+    printf(" %7s %7s %5s", "-", "-", "-");
+#endif
+}
+
+/**
+ * @brief Parse a comma separated list of serializedTypeStrings and 'temperature'
+ */
+static int watchParseTargets(watchConfig_t *config, char *list)
+{
+    char *save = NULL;
+
+    for (char *name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        int target = getmfrSerializedTypeFromString(name);
+        int known = (target != mfrSERIALIZED_TYPE_MAX);
+#ifdef THERMAL_PROTECTION_ENABLED
+        if (strcmp(name, "temperature") == 0) {
+            target = WATCH_TARGET_TEMPERATURE;
+            known = 1;
+        }
+#endif
+        if (!known || config->targetCount == WATCH_MAX_TARGETS) {
+            printf("Unknown watch target '%s'\n", name);
+            return -1;
+        }
+        config->targets[config->targetCount++] = target;
+    }
+    return 0;
+}
+
+static const char *watchTargetName(int target)
+{
+    return (target == WATCH_TARGET_TEMPERATURE) ? "temperature" : mfrSerializedTypeString[target];
+}
+
+int runWatch(unsigned int seconds, char *targetList, int threadCount, unsigned int rate, unsigned int interval)
+{
+    watchConfig_t config;
+    watchTotals_t totals;
+    watchTotals_t previous;
+    watchTotals_t delta;
+    uint64_t begin;
+    uint64_t last;
+
+    memset(&config, 0, sizeof(config));
+    config.threadCount = threadCount;
+    config.rate = rate;
+    if (targetList) {
+        if (watchParseTargets(&config, targetList) == -1) {
+            return -1;
+        }
+    } else {
+        for (mfrSerializedType_t i = mfrSERIALIZED_TYPE_MANUFACTURER; mfrSerializedTypeString[i]; i++) {
+            config.targets[config.targetCount++] = i;
+        }
+    }
+    if (seconds == 0 || interval == 0 || threadCount <= 0 || threadCount > WATCH_MAX_THREADS || config.targetCount == 0) {
+        printf("Invalid watch arguments\n");
+        return -1;
+    }
+    config.threads = (watchThread_t *)calloc(threadCount, sizeof(watchThread_t));
+    if (!config.threads) {
+        printf("Memory alloc error\n");
+        return -1;
+    }
+
+    printf("mfr_init returned '%x'\n", mfr_init());
+    printf("%d thread(s), %s, %d target(s), %u s\n", threadCount, rate ? "fixed rate" : "flat-out",
+           config.targetCount, seconds);
+    printf("%8s %12s %10s %10s %10s %8s", "time(s)", "ops/s", "p50(us)", "p99(us)", "max(us)", "errors");
+#ifdef THERMAL_PROTECTION_ENABLED
+    printf(" %7s %7s %5s", "core(C)", "wifi(C)", "state");
+#endif
+    printf("\n");
+
+    /* spread the threads over the targets, so they do not all call the same one at once */
+    begin = last = watchNowNs();
+    for (int i = 0; i < threadCount; i++) {
+        config.threads[i].config = &config;
+        config.threads[i].first = i % config.targetCount;
+        if (pthread_create(&config.threads[i].tid, NULL, watchThreadMain, &config.threads[i]) != 0) {
+            printf("Failed to start watch thread %d\n", i);
+            config.threadCount = threadCount = i;
+            break;
+        }
+    }
+
+    memset(&previous, 0, sizeof(previous));
+    for (unsigned int elapsed = 0; elapsed < seconds; ) {
+        unsigned int step = (seconds - elapsed < interval) ? seconds - elapsed : interval;
+        uint64_t now;
+        sleep(step);
+        elapsed += step;
+
+        now = watchNowNs();
+        watchCollect(&config, -1, &totals);
+        delta.calls = totals.calls - previous.calls;
+        delta.errors = totals.errors - previous.errors;
+        for (int b = 0; b < WATCH_HIST_BUCKETS; b++) {
+            delta.hist[b] = totals.hist[b] - previous.hist[b];
+        }
+        printf("%8u %12.0f %10.2f %10.2f %10.2f %8llu", elapsed, delta.calls / ((now - last) / 1e9),
+               watchPercentileUs(&delta, 50.0), watchPercentileUs(&delta, 99.0), watchMaxUs(&delta),
+               (unsigned long long)delta.errors);
+        watchPrintTemperature();
+        printf("\n");
+        fflush(stdout);
+        previous = totals;
+        last = now;
+    }
+
+    atomic_store(&config.stop, 1);
+    for (int i = 0; i < threadCount; i++) {
+        pthread_join(config.threads[i].tid, NULL);
+    }
+    last = watchNowNs();
+
+    printf("\n%-28s %10s %8s %12s %10s %10s %10s\n", "target", "calls", "errors", "ops/s", "p50(us)", "p99(us)", "max(us)");
+    for (int i = 0; i < config.targetCount; i++) {
+        watchCollect(&config, i, &totals);
+        printf("%-28s %10llu %8llu %12.0f %10.2f %10.2f %10.2f\n", watchTargetName(config.targets[i]),
+               (unsigned long long)totals.calls, (unsigned long long)totals.errors,
+               totals.calls / ((last - begin) / 1e9), watchPercentileUs(&totals, 50.0),
+               watchPercentileUs(&totals, 99.0), watchMaxUs(&totals));
+    }
+
+    printf("mfr_term returned '%x'\n", mfr_term());
+    free(config.threads);
+    return 0;
+}
+
 int main(int argc, char **argv) {
     int c;
+    int showStats = 0;
+    int otherOptions = 0;
+    int ret = 0;
+    unsigned int watchSeconds = 0;
+    char *watchTargets = NULL;
+    int watchThreads = 1;
+    unsigned int watchRate = 0;
+    unsigned int watchInterval = 1;
     if (argc >= 2) {
-        while ((c = getopt(argc, argv, "r:a")) != -1) {
+        while ((c = getopt(argc, argv, "r:ajsw:t:n:f:i:")) != -1) {
             switch (c) {
+                case 'w':
+                    otherOptions = 1;
+                    watchSeconds = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+                case 't':
+                    watchTargets = optarg;
+                    break;
+                case 'n':
+                    watchThreads = atoi(optarg);
+                    break;
+                case 'f':
+                    watchRate = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+                case 'i':
+                    watchInterval = (unsigned int)strtoul(optarg, NULL, 10);
+                    break;
+                case 'j':
+                    otherOptions = 1;
+                    ret = dumpSerializedDataJson();
+                    break;
+                case 's':
+                    showStats = 1;
+                    break;
                 case 'r':
+                    otherOptions = 1;
                     if (optarg) {
                         printSerializedData(getmfrSerializedTypeFromString(optarg));
                     } else {
@@ -130,6 +659,7 @@ int main(int argc, char **argv) {
                     }
                     break;
                 case 'a':
+                    otherOptions = 1;
                     for (mfrSerializedType_t i = mfrSERIALIZED_TYPE_MANUFACTURER; mfrSerializedTypeString[i]; i++) {
                         printSerializedData(i);
                         printf("\n");
@@ -144,5 +674,14 @@ int main(int argc, char **argv) {
         showUsage(argv[0]);
         return -1;
     }
-    return 0;
+    if (watchSeconds) {
+        ret = runWatch(watchSeconds, watchTargets, watchThreads, watchRate, watchInterval);
+    }
+    if (showStats) {
+        if (!otherOptions) {
+            readAllSerializedData();
+        }
+        printStats();
+    }
+    return ret;
 }
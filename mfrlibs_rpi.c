@@ -19,37 +19,222 @@
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <net/if.h>
 #include <arpa/inet.h>
 #include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #include <mfrMgr.h>
 #include <mfrTypes.h>
 #include <mfr_wifi_types.h>
 #include <mfr_wifi_api.h>
 
+#include "mfrlibs_rpi.h"
+#ifdef NATIVE_IMAGE_WRITE_ENABLED
+#include "mfrlib_image.h"
+#endif
+#include "mfrlib_kvparser.h"
+#include "mfrlib_logger.h"
+#include "mfrlib_root.h"
+#include "mfrlib_stats.h"
+
 #define MAX_BUF_LEN 255
 #define MAC_ADDRESS_SIZE 32
 #define LOG_CONFIG_FILE "/etc/debug.ini"
+#define DEVICE_PROPERTIES_FILE "/etc/device.properties"
+#define CPUINFO_FILE "/proc/cpuinfo"
+#define VERSION_FILE "/version.txt"
+
+/* Subset of <bluetooth/hci.h>; kept here so the HAL does not need the bluez headers to build */
+#ifndef BTPROTO_HCI
+#define BTPROTO_HCI 1
+#endif
+#define HCI_DEV_ID 0
+#define HCIGETDEVINFO _IOR('H', 211, int)
+
+struct hciDevInfo {
+    uint16_t devId;
+    char name[8];
+    uint8_t bdaddr[6];
+    uint32_t flags;
+    uint8_t type;
+    uint8_t features[8];
+    uint32_t pktType;
+    uint32_t linkPolicy;
+    uint32_t linkMode;
+    uint16_t aclMtu;
+    uint16_t aclPkts;
+    uint16_t scoMtu;
+    uint16_t scoPkts;
+    uint32_t stat[10];
+};
 
 const char defaultDescription[] = "RaspberryPi RDKV Reference Device";
 const char defaultProductClass[] = "RDKV";
 const char defaultSoftwareVersion[] = "2.0";
-static int isInitialized = 0;
-static int isDebugEnabled = 0;
+/*
+ * Threading model: the IARM bus calls into this library from several threads.
+ * - mfr_init and mfr_term are serialized by initLock; they must not race with other calls.
+ * - The init state and debug flag are atomics, so every API checks them without locking.
+ * - The device identity snapshot is immutable once published through currentSnapshot.
+ *   Readers take it with one acquire load and never block. A re-read entry is published
+ *   as a new copy under snapshotWriteLock. Superseded copies are released by mfr_term.
+ */
+static atomic_int isInitialized = 0;
+static atomic_int isDebugEnabled = 0;
+static pthread_mutex_t initLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t logConfigOnce = PTHREAD_ONCE_INIT;
+
+/* Device identity snapshot; one entry per mfrSerializedType_t, filled by mfr_init */
+typedef struct {
+    mfrError_t status;
+    size_t len;
+    const char *value;          /* storage, or static storage for constant types */
+    char storage[MAX_BUF_LEN];
+} serializedSnapshotEntry_t;
+
+typedef struct serializedSnapshot {
+    serializedSnapshotEntry_t entries[mfrSERIALIZED_TYPE_MAX];
+    struct serializedSnapshot *previous;    /* superseded copy, kept until mfr_term */
+} serializedSnapshot_t;
+
+static serializedSnapshot_t *_Atomic currentSnapshot = NULL;
+static pthread_mutex_t snapshotWriteLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Backoff of the re-reads of unavailable CACHE_RETRY entries, so that a source which never
+ * shows up (eg, no bluetooth controller, which falls back to spawning hciconfig) is not read
+ * again on every request. The window doubles after each failed re-read, up to the maximum.
+ */
+#define SERIALIZED_RETRY_BACKOFF_MIN_NS 1000000000ull
+#define SERIALIZED_RETRY_BACKOFF_MAX_NS 64000000000ull
+static _Atomic uint64_t serializedRetryNotBefore[mfrSERIALIZED_TYPE_MAX];
+static _Atomic uint64_t serializedRetryBackoff[mfrSERIALIZED_TYPE_MAX];
+
+/* Key/value files the serialized data is read from */
+typedef enum {
+    KV_SOURCE_DEVICE_PROPERTIES = 0,
+    KV_SOURCE_CPUINFO,
+    KV_SOURCE_VERSION_FILE,
+    KV_SOURCE_MAX
+} kvSource_t;
+
+static const struct {
+    const char *path;
+    char separator;
+} kvSourceFiles[KV_SOURCE_MAX] = {
+    [KV_SOURCE_DEVICE_PROPERTIES] = { DEVICE_PROPERTIES_FILE, '=' },
+    [KV_SOURCE_CPUINFO]           = { CPUINFO_FILE, ':' },
+    [KV_SOURCE_VERSION_FILE]      = { VERSION_FILE, ':' },
+};
+
+/* Hardware addresses of the network interfaces, from one RTM_GETLINK dump */
+#define LINK_CACHE_SIZE 32
+
+typedef struct {
+    struct {
+        char name[IFNAMSIZ];
+        unsigned char addr[6];
+    } links[LINK_CACHE_SIZE];
+    int count;
+} linkCache_t;
+
+/* Sources read while reading serialized data; state is 0 not read yet, 1 read, -1 failed */
+typedef struct {
+    kvFile_t kv[KV_SOURCE_MAX];
+    int state[KV_SOURCE_MAX];
+    linkCache_t links;
+    int linkState;
+    unsigned int refreshed;     /* snapshot entries re-read from their source */
+} serializedSources_t;
+
+/* Where the value of a mfrSerializedType_t comes from */
+typedef enum {
+    SERIALIZED_SOURCE_UNSUPPORTED = 0,
+    SERIALIZED_SOURCE_CONSTANT,                 /* key is the value */
+    SERIALIZED_SOURCE_DEVICE_PROPERTIES,        /* key in /etc/device.properties */
+    SERIALIZED_SOURCE_CPUINFO,                  /* key in /proc/cpuinfo */
+    SERIALIZED_SOURCE_VERSION_FILE,             /* key in /version.txt */
+    SERIALIZED_SOURCE_INTERFACE_MAC,            /* key is the network interface name */
+    SERIALIZED_SOURCE_PROPERTY_INTERFACE_MAC,   /* key in /etc/device.properties naming the interface */
+    SERIALIZED_SOURCE_MANUFACTURER_OUI,         /* OUI part of the eth0 MAC */
+    SERIALIZED_SOURCE_BD_ADDRESS,               /* bluetooth controller address */
+} serializedSourceKind_t;
+
+/* How the value of a mfrSerializedType_t is kept in the snapshot */
+typedef enum {
+    CACHE_NONE = 0,     /* unsupported; nothing to keep */
+    CACHE_STATIC,       /* constant served from static storage */
+    CACHE_BOOT,         /* read once by mfr_init */
+    CACHE_RETRY,        /* read by mfr_init and again on request until the source is available */
+} serializedCachePolicy_t;
+
+typedef struct {
+    serializedSourceKind_t source;
+    const char *key;
+    serializedCachePolicy_t cache;
+    const char *label;
+} serializedTypeDesc_t;
+
+/* Keep in sync with mfrSerializedType_t from mfrTypes.h; types not listed are unsupported */
+static const serializedTypeDesc_t serializedTypeTable[mfrSERIALIZED_TYPE_MAX] = {
+    [mfrSERIALIZED_TYPE_MANUFACTURER]              = { SERIALIZED_SOURCE_DEVICE_PROPERTIES, "MANUFACTURE", CACHE_BOOT, "Manufacturer" },
+    /* unique identifier of the Manufacturer :: we are using the first 6 chars of the mac address */
+    [mfrSERIALIZED_TYPE_MANUFACTUREROUI]           = { SERIALIZED_SOURCE_MANUFACTURER_OUI, NULL, CACHE_RETRY, "Manufacturer OUI" },
+    [mfrSERIALIZED_TYPE_MODELNAME]                 = { SERIALIZED_SOURCE_DEVICE_PROPERTIES, "DEVICE_NAME", CACHE_BOOT, "Model Name" },
+    [mfrSERIALIZED_TYPE_DESCRIPTION]               = { SERIALIZED_SOURCE_CONSTANT, defaultDescription, CACHE_STATIC, "Description" },
+    [mfrSERIALIZED_TYPE_PRODUCTCLASS]              = { SERIALIZED_SOURCE_CONSTANT, defaultProductClass, CACHE_STATIC, "Product Class" },
+    [mfrSERIALIZED_TYPE_SERIALNUMBER]              = { SERIALIZED_SOURCE_CPUINFO, "Serial", CACHE_BOOT, "Serial Number" },
+    [mfrSERIALIZED_TYPE_HARDWAREVERSION]           = { SERIALIZED_SOURCE_CPUINFO, "Revision", CACHE_BOOT, "Hardware Version" },
+    [mfrSERIALIZED_TYPE_SOFTWAREVERSION]           = { SERIALIZED_SOURCE_CONSTANT, defaultSoftwareVersion, CACHE_STATIC, "Software Version" },
+    [mfrSERIALIZED_TYPE_PROVISIONINGCODE]          = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "Provisioning Code" },
+    [mfrSERIALIZED_TYPE_FIRSTUSEDATE]              = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "First Use Date" },
+    [mfrSERIALIZED_TYPE_DEVICEMAC]                 = { SERIALIZED_SOURCE_INTERFACE_MAC, "eth0", CACHE_RETRY, "Device MAC" },
+    /* get MOCA_INTERFACE from device.properties and retieve its MAC */
+    [mfrSERIALIZED_TYPE_MOCAMAC]                   = { SERIALIZED_SOURCE_PROPERTY_INTERFACE_MAC, "MOCA_INTERFACE", CACHE_RETRY, "MOCA MAC" },
+    [mfrSERIALIZED_TYPE_HDMIHDCP]                  = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "HDMI HDCP" },
+    [mfrSERIALIZED_TYPE_PDRIVERSION]               = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "PDRI Version" },
+    [mfrSERIALIZED_TYPE_WIFIMAC]                   = { SERIALIZED_SOURCE_INTERFACE_MAC, "wlan0", CACHE_RETRY, "WiFi MAC" },
+    [mfrSERIALIZED_TYPE_BLUETOOTHMAC]              = { SERIALIZED_SOURCE_BD_ADDRESS, NULL, CACHE_RETRY, "Bluetooth MAC" },
+    [mfrSERIALIZED_TYPE_WPSPIN]                    = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "WPS PIN" },
+    [mfrSERIALIZED_TYPE_MANUFACTURING_SERIALNUMBER] = { SERIALIZED_SOURCE_CPUINFO, "Serial", CACHE_BOOT, "Manufacturing Serial Number" },
+    [mfrSERIALIZED_TYPE_ETHERNETMAC]               = { SERIALIZED_SOURCE_INTERFACE_MAC, "eth0", CACHE_RETRY, "Ethernet MAC" },
+    [mfrSERIALIZED_TYPE_ESTBMAC]                   = { SERIALIZED_SOURCE_INTERFACE_MAC, "eth0", CACHE_RETRY, "ESTB MAC" },
+    [mfrSERIALIZED_TYPE_RF4CEMAC]                  = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "RF4CE MAC" },
+    [mfrSERIALIZED_TYPE_PROVISIONED_MODELNAME]     = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "Provisioned Model Name" },
+    [mfrSERIALIZED_TYPE_PMI]                       = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "PMI" },
+    /* Read cpuinfo and use Revision */
+    [mfrSERIALIZED_TYPE_HWID]                      = { SERIALIZED_SOURCE_CPUINFO, "Revision", CACHE_BOOT, "HWID" },
+    [mfrSERIALIZED_TYPE_MODELNUMBER]               = { SERIALIZED_SOURCE_CPUINFO, "Revision", CACHE_BOOT, "Model Number" },
+    /* Read cpuinfo and use Hardware */
+    [mfrSERIALIZED_TYPE_SOC_ID]                    = { SERIALIZED_SOURCE_CPUINFO, "Hardware", CACHE_BOOT, "SOC ID" },
+    [mfrSERIALIZED_TYPE_IMAGENAME]                 = { SERIALIZED_SOURCE_VERSION_FILE, "imagename", CACHE_BOOT, "Image Name" },
+    [mfrSERIALIZED_TYPE_IMAGETYPE]                 = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "Image Type" },
+    [mfrSERIALIZED_TYPE_BLVERSION]                 = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "Bootloader Version" },
+    [mfrSERIALIZED_TYPE_REGION]                    = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "Region" },
+    [mfrSERIALIZED_TYPE_BDRIVERSION]               = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "BDRI Version" },
+    [mfrSERIALIZED_TYPE_LED_WHITE_LEVEL]           = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "LED White Level" },
+    [mfrSERIALIZED_TYPE_LED_PATTERN]               = { SERIALIZED_SOURCE_UNSUPPORTED, NULL, CACHE_NONE, "LED Pattern" },
+};
 
 /* Mechanism to make this a single instance */
 #ifdef ENABLE_SINGLE_INSTANCE_LOCK
 
 #define MFRHAL_LOCK_FILE "/run/mfrhallibrary.lock"
-static int lockFd = -1;
+/* updated under initLock; lockFd is also read by isLibraryInitialized */
+static atomic_int lockFd = -1;
 static int lockRefCount = 0;
 
 int acquireLock(void)
@@ -59,7 +244,8 @@ int acquireLock(void)
         return 0;
     }
 
-    int fd = open(MFRHAL_LOCK_FILE, O_CREAT | O_RDWR, 0666);
+    char path[PATH_MAX];
+    int fd = open(rootedPath(MFRHAL_LOCK_FILE, path, sizeof(path)), O_CREAT | O_RDWR, 0666);
     if (fd == -1) {
         return -1;
     }
@@ -95,12 +281,12 @@ int releaseLock(void)
 
 int isLibraryInitialized(void)
 {
-    if (!isInitialized) {
+    if (!atomic_load_explicit(&isInitialized, memory_order_acquire)) {
         return 0;
     }
 
 #ifdef ENABLE_SINGLE_INSTANCE_LOCK
-    if (lockFd == -1) {
+    if (atomic_load_explicit(&lockFd, memory_order_relaxed) == -1) {
         return 0;
     }
 #endif
@@ -108,54 +294,87 @@ int isLibraryInitialized(void)
     return 1;
 }
 
-/* Logging function */
+/* Logging function; entries are queued and written out by the logger thread */
 void mfrlib_log(const char *format, ...)
 {
-    if (!isDebugEnabled) {
+    if (!atomic_load_explicit(&isDebugEnabled, memory_order_relaxed)) {
         return;
     }
 
     va_list args;
     va_start(args, format);
-    vfprintf(stdout, format, args);
+    loggerWrite(format, args);
     va_end(args);
 }
 
 /**
  * @brief enable/disable debug logging
- * @info This function reads the debug.ini configuration file and enables logging if debug is enabled
+ * @info This function reads the debug.ini configuration file and enables logging if debug is enabled.
+ *       It runs once from mfr_init, then on the logger thread whenever debug.ini changes.
  */
 void configMFRLibLogging(void)
 {
-    if (access(LOG_CONFIG_FILE, F_OK) == -1) {
-        perror("configMFRLibLogging error accessing debug.ini\n");
-        return;
-    }
-    FILE *file = fopen(LOG_CONFIG_FILE, "r");
-    if (!file) {
-        perror("configMFRLibLogging error fopen debug.ini\n");
-        return;
-    }
-
-    char line[MAX_BUF_LEN] = {0};
-    while (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\n")] = '\0';
-        // Check for the LOG.RDK.MFRMGR entry
-        if (strncmp(line, "LOG.RDK.MFRMGR", 14) == 0) {
-            if (strstr(line, "DEBUG") && !strstr(line, "!DEBUG")) {
-                isDebugEnabled = 1;
-            } else {
-                isDebugEnabled = 0;
-            }
-            break;
+    kvFile_t kv;
+    char path[PATH_MAX];
+    char value[MAX_BUF_LEN] = {0};
+    int enabled = 0;
+
+    /* a missing file or LOG.RDK.MFRMGR entry means debug is off. Read rather than mapped, as
+     * the file may be truncated by another edit while it is parsed */
+    if (kvFileLoad(&kv, rootedPath(LOG_CONFIG_FILE, path, sizeof(path)), '=') == 0) {
+        if (kvFileLookup(&kv, "LOG.RDK.MFRMGR", value, sizeof(value)) == 0) {
+            enabled = (strstr(value, "DEBUG") && !strstr(value, "!DEBUG"));
         }
+        kvFileRelease(&kv);
     }
+    atomic_store_explicit(&isDebugEnabled, enabled, memory_order_relaxed);
+}
+
+/**
+ * @brief Read debug.ini and keep watching it for changes
+ */
+static void initMFRLibLogging(void)
+{
+    char path[PATH_MAX];
 
-    fclose(file);
+    /* watch first, so a change made while the file is read is not missed */
+    loggerWatchConfig(rootedPath(LOG_CONFIG_FILE, path, sizeof(path)), configMFRLibLogging);
+    configMFRLibLogging();
 }
 
 /* MFR wrapper implementations */
 
+/**
+ * @brief Get the value matching the given key from a key/value file
+ * @param path file to read
+ * @param key exact key to search for in the file
+ * @param separator separator character between key and value
+ * @param valueOut output buffer to store the value matching the key
+ * @param maxLen size of the output buffer
+ * @return 0 on success, -1 on failure
+ */
+static int getValueMatchingKeyFromFile(const char *path, const char *key, char separator, char *valueOut, size_t maxLen)
+{
+    kvFile_t kv;
+    char rooted[PATH_MAX];
+    int retValue = -1;
+
+    path = rootedPath(path, rooted, sizeof(rooted));
+    if (kvFileMap(&kv, path, separator) == -1) {
+        mfrlib_log("getValueMatchingKeyFromFile failed to read '%s'.\n", path);
+        return retValue;
+    }
+
+    retValue = kvFileLookup(&kv, key, valueOut, maxLen);
+    if (retValue == 0) {
+        mfrlib_log("getValueMatchingKeyFromFile key='%s', value='%s'\n", key, valueOut);
+    } else {
+        mfrlib_log("getValueMatchingKeyFromFile key '%s' not found in '%s'.\n", key, path);
+    }
+    kvFileRelease(&kv);
+    return retValue;
+}
+
 /**
  * @brief Get the value matching the given key from the version file
  * @param key key to search for in the '/version.txt' file
@@ -166,84 +385,111 @@ void configMFRLibLogging(void)
  */
 int getValueFromVersionFile(const char *key, char separator, char *valueOut, size_t maxLen)
 {
-    FILE *fp;
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
-    size_t keyLen = strlen(key);
-    int found = 0;
-    int retValue = -1;
-
     if (!key || !valueOut || maxLen <= 0) {
         mfrlib_log("getValueFromVersionFile invalid input.\n");
-        return retValue;
+        return -1;
     }
     /* check if separator is a printable character */
     if (!isprint(separator)) {
         mfrlib_log("getValueFromVersionFile invalid separator.\n");
-        return retValue;
+        return -1;
     }
 
-    if (access("/version.txt", F_OK) == -1) {
-        mfrlib_log("getValueFromVersionFile /version.txt file not found.\n");
-        return retValue;
-    }
+    return getValueMatchingKeyFromFile(VERSION_FILE, key, separator, valueOut, maxLen);
+}
 
-    fp = fopen("/version.txt", "r");
-    if (NULL == fp) {
-        mfrlib_log("getValueFromVersionFile fopen failed for /version.txt\n");
-        return retValue;
-    }
+#ifdef MFRLIB_ROOT_SUPPORT
+/**
+ * @brief Read a hardware address from a file under MFRLIB_ROOT instead of the host's devices
+ * @param path absolute path of the address file, eg "/sys/class/net/eth0/address"
+ * @param address output buffer to store the address, upper case
+ * @param maxLen size of the output buffer
+ * @return 0 on success, -1 if the file is missing under the root, 1 if no root is set
+ */
+static int readRootedAddress(const char *path, char *address, size_t maxLen)
+{
+    char rooted[PATH_MAX];
+    char line[MAX_BUF_LEN];
+    FILE *fp = NULL;
+    size_t len;
 
-    while ((read = getline(&line, &len, fp)) != -1) {
-        if (strncmp(line, key, keyLen) == 0 && line[keyLen] == separator) {
-            char *value = line + keyLen + 1;
-            while (*value == ' ' && *value != '\0') value++;
-            int i = 0;
-            while (value[i] != '\0' && value[i] != '\n' && value[i] != '\r' && i < maxLen - 1) {
-                valueOut[i] = value[i];
-                i++;
-            }
-            valueOut[i] = '\0';
-            found = 1;
-            retValue = 0;
-            break;
-        }
+    if (rootedPath(path, rooted, sizeof(rooted)) == path) {
+        return 1;
+    }
+    fp = fopen(rooted, "re");
+    if (!fp) {
+        mfrlib_log("readRootedAddress failed to open '%s'.\n", rooted);
+        return -1;
+    }
+    if (!fgets(line, sizeof(line), fp)) {
+        fclose(fp);
+        return -1;
     }
     fclose(fp);
+    len = strcspn(line, " \n");
+    if (len == 0 || len >= maxLen) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        address[i] = (char)toupper((unsigned char)line[i]);
+    }
+    address[len] = '\0';
+    return 0;
+}
+#endif /* MFRLIB_ROOT_SUPPORT */
 
-    if (line) {
-        free(line);
+/**
+ * @brief Get the MAC address of the bluetooth interface from the HCI socket
+ * @param bdAddress output buffer to store the MAC address in string format
+ * @param maxLen size of the output buffer
+ * @return 0 on success, -1 on failure
+ */
+static int getBDAddressFromHCISocket(char *bdAddress, size_t maxLen)
+{
+    struct hciDevInfo devInfo;
+    const uint8_t *b = devInfo.bdaddr;
+    int fd = -1;
+    int retVal = -1;
+
+    fd = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC, BTPROTO_HCI);
+    if (fd == -1) {
+        mfrlib_log("getBDAddressFromHCISocket socket() call error.\n");
+        return retVal;
     }
 
-    if (!found) {
-        mfrlib_log("getline failed or key not found in /version.txt\n");
+    memset(&devInfo, 0, sizeof(devInfo));
+    devInfo.devId = HCI_DEV_ID;
+    if (ioctl(fd, HCIGETDEVINFO, &devInfo) == -1) {
+        mfrlib_log("getBDAddressFromHCISocket ioctl() call error.\n");
+    } else if (!(b[0] | b[1] | b[2] | b[3] | b[4] | b[5])) {
+        /* BDADDR_ANY; controller is registered but not set up yet */
+        mfrlib_log("getBDAddressFromHCISocket hci%d has no address yet.\n", HCI_DEV_ID);
+    } else {
+        /* bdaddr is stored little endian; print it the way hciconfig does */
+        snprintf(bdAddress, maxLen, "%02X:%02X:%02X:%02X:%02X:%02X", b[5], b[4], b[3], b[2], b[1], b[0]);
+        retVal = 0;
     }
+    close(fd);
 
-    return retValue;
+    return retVal;
 }
 
 /**
- * @brief Get the MAC address of the bluetooth interface
+ * @brief Get the MAC address of the bluetooth interface from the hciconfig output
  * @param bdAddress output buffer to store the MAC address in string format
  * @param maxLen size of the output buffer
  * @return 0 on success, -1 on failure
  */
-int getBDAddress(char *bdAddress, size_t maxLen)
+static int getBDAddressFromHciconfig(char *bdAddress, size_t maxLen)
 {
     FILE *fp = NULL;
     char buffer[MAX_BUF_LEN] = {0};
     char *addr_start = NULL;
     int retVal = -1;
 
-    if (!bdAddress || maxLen < 18) { // Bluetooth address is 17 characters + null terminator
-        mfrlib_log("getBDAddress invalid input.\n");
-        return retVal;
-    }
-
     fp = popen("hciconfig -a | grep 'BD Address'", "r");
     if (NULL == fp) {
-        mfrlib_log("getBDAddress popen failed\n");
+        mfrlib_log("getBDAddressFromHciconfig popen failed\n");
         return retVal;
     }
 
@@ -259,16 +505,48 @@ int getBDAddress(char *bdAddress, size_t maxLen)
             bdAddress[addr_len] = '\0';
             retVal = 0;
         } else {
-            mfrlib_log("getBDAddress BD Address not found in '%s' output.\n", "hciconfig -a | grep 'BD Address'");
+            mfrlib_log("getBDAddressFromHciconfig BD Address not found in '%s' output.\n", "hciconfig -a | grep 'BD Address'");
         }
     } else {
-        mfrlib_log("getBDAddress fgets failed\n");
+        mfrlib_log("getBDAddressFromHciconfig fgets failed\n");
     }
 
     pclose(fp);
     return retVal;
 }
 
+/**
+ * @brief Get the MAC address of the bluetooth interface
+ * @param bdAddress output buffer to store the MAC address in string format
+ * @param maxLen size of the output buffer
+ * @return 0 on success, -1 on failure
+ * @info Queries the controller over the HCI socket; hciconfig is only spawned if that fails.
+ */
+int getBDAddress(char *bdAddress, size_t maxLen)
+{
+    if (!bdAddress || maxLen < 18) { // Bluetooth address is 17 characters + null terminator
+        mfrlib_log("getBDAddress invalid input.\n");
+        return -1;
+    }
+
+#ifdef MFRLIB_ROOT_SUPPORT
+    char path[PATH_MAX];
+    int rc;
+
+    snprintf(path, sizeof(path), "/sys/class/bluetooth/hci%d/address", HCI_DEV_ID);
+    if ((rc = readRootedAddress(path, bdAddress, maxLen)) != 1) {
+        return rc;
+    }
+#endif
+
+    if (getBDAddressFromHCISocket(bdAddress, maxLen) == 0) {
+        return 0;
+    }
+
+    mfrlib_log("getBDAddress HCI lookup failed, falling back to hciconfig.\n");
+    return getBDAddressFromHciconfig(bdAddress, maxLen);
+}
+
 /**
  * @brief Get the MAC address of the given interface
  * @param iface network interface name
@@ -276,7 +554,7 @@ int getBDAddress(char *bdAddress, size_t maxLen)
  * @param size size of the output buffer
  * @return 0 on success, -1 on failure
  */
-int getInterfaceMACString(char *iface, char *outMACString, size_t size)
+int getInterfaceMACString(const char *iface, char *outMACString, size_t size)
 {
     int fd = -1;
     struct ifreq ifr;
@@ -308,6 +586,25 @@ int getInterfaceMACString(char *iface, char *outMACString, size_t size)
     return retVal;
 }
 
+/**
+ * @brief Take the OUI out of a MAC address string
+ * @param macAddress MAC address in string format
+ * @param ouiHexString output buffer of at least 7 bytes
+ */
+static void getOUIFromMACString(const char *macAddress, char *ouiHexString)
+{
+    /* take the first 3 and remove the colon from string. eg, e4:5f:01:56:f4:82 -> e45f01 */
+    const char *ptr = macAddress;
+    int i = 0;
+    while (*ptr != '\0' && i < 6) {
+        if (*ptr != ':') {
+            ouiHexString[i++] = *ptr;
+        }
+        ptr++;
+    }
+    ouiHexString[i] = '\0';
+}
+
 /**
  * @brief Get the manufacturer OUI in hex string format
  * @param interface network interface name; for RPI, OUI is 6 bytes of the eth0 MAC address
@@ -323,80 +620,113 @@ int getManufacturerOUIHexString(char *ouiHexString, size_t size)
         return retVal;
     }
     if (getInterfaceMACString("eth0", macAddress, MAC_ADDRESS_SIZE) == 0) {
-        /* take the first 3 and remove the colon from string. eg, e4:5f:01:56:f4:82 -> e45f01 */
-        char *ptr = macAddress;
-        int i = 0;
-        while (*ptr != '\0' && i < 6) {
-            if (*ptr != ':') {
-                ouiHexString[i++] = *ptr;
-            }
-            ptr++;
-        }
-        ouiHexString[i] = '\0';
+        getOUIFromMACString(macAddress, ouiHexString);
         retVal = 0;
     }
     return retVal;
 }
 
 /**
- * @brief Get the value matching the given key from the device properties file
- * @param keyIn key to search for in the device properties file
- * @param valueOut output buffer to store the value matching the key; should be atleast 50 bytes long
- * @param size size of the output buffer
+ * @brief Fetch the hardware address of every network interface with one RTM_GETLINK dump
+ * @param cache output cache of interface name and address pairs
  * @return 0 on success, -1 on failure
-*/
-int getValueMatchingKeyFromDevicePropertiesFile(const char *keyIn, char *valueOut, size_t size)
+ */
+static int dumpLinkAddresses(linkCache_t *cache)
 {
-    FILE *fp = NULL;
-    char buffer[MAX_BUF_LEN] = {0};
-    size_t len = 0;
-    ssize_t read = 0;
-    int ret = -1;
-    char *line = NULL;
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifm;
+    } req;
+    char buffer[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+    int fd = -1;
+    int retVal = -1;
+    int done = 0;
 
-    if (!keyIn || !valueOut || size <= 0) {
-        mfrlib_log("getValueMatchingKeyFromDevicePropertiesFile invalid input.\n");
-        return ret;
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd == -1) {
+        mfrlib_log("dumpLinkAddresses socket() call error.\n");
+        return retVal;
     }
 
-    if (access("/etc/device.properties", F_OK) != -1) {
-        fp = fopen("/etc/device.properties", "r");
-        if (NULL == fp) {
-            mfrlib_log("getValueMatchingKeyFromDevicePropertiesFile fopen() error.\n");
-            return ret;
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nlh.nlmsg_type = RTM_GETLINK;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq = 1;
+    req.ifm.ifi_family = AF_UNSPEC;
+    if (send(fd, &req, req.nlh.nlmsg_len, 0) == -1) {
+        mfrlib_log("dumpLinkAddresses send() call error.\n");
+        close(fd);
+        return retVal;
+    }
+
+    cache->count = 0;
+    while (!done) {
+        ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+        struct nlmsghdr *nlh = (struct nlmsghdr *)buffer;
+
+        if (len <= 0) {
+            mfrlib_log("dumpLinkAddresses recv() call error.\n");
+            break;
         }
 
-        while ((read = getline(&line, &len, fp)) != -1) {
-            if (strstr(line, keyIn) != NULL) {
-                strncpy(buffer, line, MAX_BUF_LEN - 1);
-                buffer[MAX_BUF_LEN - 1] = '\0';
+        for (; NLMSG_OK(nlh, (size_t)len); nlh = NLMSG_NEXT(nlh, len)) {
+            struct ifinfomsg *ifm = NULL;
+            struct rtattr *rta = NULL;
+            int rtaLen = 0;
+            const char *name = NULL;
+            const unsigned char *addr = NULL;
+
+            if (nlh->nlmsg_type == NLMSG_DONE) {
+                done = 1;
+                retVal = 0;
                 break;
             }
-        }
-
-        if (line) {
-            free(line);
-        }
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                mfrlib_log("dumpLinkAddresses RTM_GETLINK dump failed.\n");
+                done = 1;
+                break;
+            }
+            if (nlh->nlmsg_type != RTM_NEWLINK || cache->count >= LINK_CACHE_SIZE) {
+                continue;
+            }
 
-        if (buffer[0] != '\0') {
-            char *value = strchr(buffer, '=');
-            if (value) {
-                value++;
-                int i = 0;
-                while (value[i] != '\0' && value[i] != '\n' && value[i] != '\r' && i < size - 1) {
-                    valueOut[i] = value[i];
-                    i++;
+            ifm = NLMSG_DATA(nlh);
+            rtaLen = IFLA_PAYLOAD(nlh);
+            for (rta = IFLA_RTA(ifm); RTA_OK(rta, rtaLen); rta = RTA_NEXT(rta, rtaLen)) {
+                if (rta->rta_type == IFLA_IFNAME) {
+                    name = RTA_DATA(rta);
+                } else if (rta->rta_type == IFLA_ADDRESS && RTA_PAYLOAD(rta) == sizeof(cache->links[0].addr)) {
+                    addr = RTA_DATA(rta);
                 }
-                valueOut[i] = '\0';
-                ret = 0;
+            }
+            if (name && addr) {
+                snprintf(cache->links[cache->count].name, IFNAMSIZ, "%s", name);
+                memcpy(cache->links[cache->count].addr, addr, sizeof(cache->links[0].addr));
+                cache->count++;
             }
         }
-        fclose(fp);
-        mfrlib_log("getValueMatchingKeyFromDevicePropertiesFile key='%s', value='%s'\n", keyIn, valueOut);
-    } else {
-        mfrlib_log("getValueMatchingKeyFromDevicePropertiesFile device.properties file not found.\n");
     }
-    return ret;
+    close(fd);
+
+    return retVal;
+}
+
+/**
+ * @brief Get the value matching the given key from the device properties file
+ * @param keyIn key to search for in the device properties file
+ * @param valueOut output buffer to store the value matching the key; should be atleast 50 bytes long
+ * @param size size of the output buffer
+ * @return 0 on success, -1 on failure
+*/
+int getValueMatchingKeyFromDevicePropertiesFile(const char *keyIn, char *valueOut, size_t size)
+{
+    if (!keyIn || !valueOut || size <= 0) {
+        mfrlib_log("getValueMatchingKeyFromDevicePropertiesFile invalid input.\n");
+        return -1;
+    }
+
+    return getValueMatchingKeyFromFile(DEVICE_PROPERTIES_FILE, keyIn, '=', valueOut, size);
 }
 
 /**
@@ -408,59 +738,101 @@ int getValueMatchingKeyFromDevicePropertiesFile(const char *keyIn, char *valueOu
 */
 int getValueMatchingKeyFromCPUINFO(const char *keyIn, char *valueOut, size_t size)
 {
-    FILE *fp = NULL;
-    char buffer[MAX_BUF_LEN] = {0};
-    size_t len = 0;
-    ssize_t read = 0;
-    int ret = -1;
-    char *line = NULL;
-
     if (!keyIn || !valueOut || size <= 0) {
         mfrlib_log("getValueMatchingKeyFromCPUINFO invalid input.\n");
-        return ret;
+        return -1;
     }
 
-    if (access("/proc/cpuinfo", F_OK) != -1) {
-        fp = fopen("/proc/cpuinfo", "r");
-        if (NULL == fp) {
-            mfrlib_log("getValueMatchingKeyFromCPUINFO fopen() error.\n");
-            return ret;
-        }
+    return getValueMatchingKeyFromFile(CPUINFO_FILE, keyIn, ':', valueOut, size);
+}
 
-        while ((read = getline(&line, &len, fp)) != -1) {
-            if (strstr(line, keyIn) != NULL) {
-                strncpy(buffer, line, MAX_BUF_LEN - 1);
-                buffer[MAX_BUF_LEN - 1] = '\0';
-                break;
-            }
+/**
+ * @brief Look up the given key in one of the key/value sources
+ * @param sources parsed sources; each file is parsed on first use and then served from its index
+ * @param source key/value source to search
+ * @param key exact key to search for
+ * @param valueOut output buffer to store the value matching the key
+ * @param size size of the output buffer
+ * @return 0 on success, -1 on failure
+ */
+static int lookupSourceValue(serializedSources_t *sources, kvSource_t source, const char *key, char *valueOut, size_t size)
+{
+    char path[PATH_MAX];
+
+    if (sources->state[source] == 0) {
+        if (kvFileMap(&sources->kv[source], rootedPath(kvSourceFiles[source].path, path, sizeof(path)), kvSourceFiles[source].separator) == 0) {
+            sources->state[source] = 1;
+        } else {
+            mfrlib_log("lookupSourceValue failed to read '%s'.\n", kvSourceFiles[source].path);
+            sources->state[source] = -1;
         }
+    }
+    if (sources->state[source] != 1) {
+        return -1;
+    }
+
+    if (kvFileLookup(&sources->kv[source], key, valueOut, size) == -1) {
+        mfrlib_log("lookupSourceValue key '%s' not found in '%s'.\n", key, kvSourceFiles[source].path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Release the files parsed by lookupSourceValue
+ */
+static void releaseSources(serializedSources_t *sources)
+{
+    int source;
 
-        if (line) {
-            free(line);
+    for (source = 0; source < KV_SOURCE_MAX; source++) {
+        if (sources->state[source] == 1) {
+            kvFileRelease(&sources->kv[source]);
         }
+        sources->state[source] = 0;
+    }
+    sources->linkState = 0;
+}
 
-        if (buffer[0] != '\0') {
-            char *value = strchr(buffer, ':');
-            if (value) {
-                value++;
-                while ((*value == ' ') && (*value != '\0')) {
-                    value++;
-                }
-                int i = 0;
-                while (value[i] != '\0' && value[i] != '\n' && value[i] != '\r' && i < size - 1) {
-                    valueOut[i] = value[i];
-                    i++;
-                }
-                valueOut[i] = '\0';
-                ret = 0;
-            }
+/**
+ * @brief Get the MAC address of the given interface from the shared link dump
+ * @param sources sources shared by all reads of one pass; the link dump is taken on first use
+ * @param iface network interface name
+ * @param outMACString output buffer to store the MAC address in string format
+ * @param size size of the output buffer
+ * @return 0 on success, -1 on failure
+ * @info Falls back to the SIOCGIFHWADDR ioctl if netlink is not available.
+ */
+static int lookupLinkMACString(serializedSources_t *sources, const char *iface, char *outMACString, size_t size)
+{
+    int i;
+
+#ifdef MFRLIB_ROOT_SUPPORT
+    char path[PATH_MAX];
+    int rc;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/address", iface);
+    if ((rc = readRootedAddress(path, outMACString, size)) != 1) {
+        return rc;
+    }
+#endif
+
+    if (sources->linkState == 0) {
+        sources->linkState = (dumpLinkAddresses(&sources->links) == 0) ? 1 : -1;
+    }
+    if (sources->linkState != 1) {
+        return getInterfaceMACString(iface, outMACString, size);
+    }
+
+    for (i = 0; i < sources->links.count; i++) {
+        const unsigned char *mac = sources->links.links[i].addr;
+        if (strcmp(sources->links.links[i].name, iface) == 0) {
+            snprintf(outMACString, size, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+            return 0;
         }
-        fclose(fp);
-        mfrlib_log("getValueMatchingKeyFromCPUINFO key='%s', value='%s'\n", keyIn, valueOut);
-    } else {
-        mfrlib_log("getValueMatchingKeyFromCPUINFO cpuinfo file not found.\n");
     }
-    return ret;
+    mfrlib_log("lookupLinkMACString interface '%s' not found.\n", iface);
+    return -1;
 }
 
 /*************************************************************************************/
@@ -495,11 +867,253 @@ bool isValidMfrSerializedType(mfrSerializedType_t param) {
     return false;
 }
 
-mfrError_t mfrGetSerializedData(mfrSerializedType_t param, mfrSerializedData_t *data)
+/**
+ * @brief Read the value of the given mfrSerializedType_t from its source on the device
+ * @param param mfrSerializedType_t to read; must be below mfrSERIALIZED_TYPE_MAX
+ * @param sources key/value sources shared by all reads of one pass
+ * @param valueOut output buffer to store the value
+ * @param size size of the output buffer
+ * @return mfrERR_NONE on success, mfrERR_FLASH_READ_FAILED if the source could not be read,
+ *         mfrERR_OPERATION_NOT_SUPPORTED if the type has no data on this device
+ */
+static mfrError_t readSerializedValue(mfrSerializedType_t param, serializedSources_t *sources, char *valueOut, size_t size)
 {
-    char cmd[MAX_BUF_LEN] = {0};
-    char buffer[MAX_BUF_LEN] = {0};
-    FILE *fp = NULL;
+    const serializedTypeDesc_t *desc = &serializedTypeTable[param];
+    char iface[IFNAMSIZ] = {0};
+    char macAddress[MAC_ADDRESS_SIZE] = {0};
+    int rc = -1;
+
+    switch (desc->source) {
+    case SERIALIZED_SOURCE_CONSTANT:
+        snprintf(valueOut, size, "%s", desc->key);
+        rc = 0;
+        break;
+    case SERIALIZED_SOURCE_DEVICE_PROPERTIES:
+        rc = lookupSourceValue(sources, KV_SOURCE_DEVICE_PROPERTIES, desc->key, valueOut, size);
+        break;
+    case SERIALIZED_SOURCE_CPUINFO:
+        rc = lookupSourceValue(sources, KV_SOURCE_CPUINFO, desc->key, valueOut, size);
+        break;
+    case SERIALIZED_SOURCE_VERSION_FILE:
+        rc = lookupSourceValue(sources, KV_SOURCE_VERSION_FILE, desc->key, valueOut, size);
+        break;
+    case SERIALIZED_SOURCE_INTERFACE_MAC:
+        rc = lookupLinkMACString(sources, desc->key, valueOut, size);
+        break;
+    case SERIALIZED_SOURCE_PROPERTY_INTERFACE_MAC:
+        /* the device.properties entry names the interface, eg MOCA_INTERFACE */
+        rc = lookupSourceValue(sources, KV_SOURCE_DEVICE_PROPERTIES, desc->key, iface, sizeof(iface));
+        if (rc == 0) {
+            rc = lookupLinkMACString(sources, iface, valueOut, size);
+        }
+        break;
+    case SERIALIZED_SOURCE_MANUFACTURER_OUI:
+        /* for RPI, OUI is the first 3 bytes of the eth0 MAC address */
+        if (size < 7) {
+            break;
+        }
+        rc = lookupLinkMACString(sources, "eth0", macAddress, sizeof(macAddress));
+        if (rc == 0) {
+            getOUIFromMACString(macAddress, valueOut);
+        }
+        break;
+    case SERIALIZED_SOURCE_BD_ADDRESS:
+        rc = getBDAddress(valueOut, size);
+        break;
+    case SERIALIZED_SOURCE_UNSUPPORTED:
+    default:
+        /* Does not have any data. Report unsupported. */
+        mfrlib_log("Unsupported mfrSerializedType_t '%d'\n", param);
+        return mfrERR_OPERATION_NOT_SUPPORTED;
+    }
+
+    if (rc != 0) {
+        mfrlib_log("%s read failed, return mfrERR_FLASH_READ_FAILED.\n", desc->label);
+        return mfrERR_FLASH_READ_FAILED;
+    }
+    mfrlib_log("%s= '%s'\n", desc->label, valueOut);
+    return mfrERR_NONE;
+}
+
+/**
+ * @brief Read the given mfrSerializedType_t into a device identity snapshot entry
+ * @param param mfrSerializedType_t to read; must be below mfrSERIALIZED_TYPE_MAX
+ * @param sources key/value sources shared by all reads of one pass
+ * @param entry snapshot entry to fill
+ */
+static void loadSerializedSnapshotEntry(mfrSerializedType_t param, serializedSources_t *sources, serializedSnapshotEntry_t *entry)
+{
+    const serializedTypeDesc_t *desc = &serializedTypeTable[param];
+
+    if (desc->cache == CACHE_STATIC) {
+        /* constants are served straight from static storage */
+        entry->value = desc->key;
+        entry->len = strlen(desc->key);
+        entry->status = mfrERR_NONE;
+        return;
+    }
+
+    entry->storage[0] = '\0';
+    entry->value = entry->storage;
+    entry->status = readSerializedValue(param, sources, entry->storage, sizeof(entry->storage));
+    entry->len = (entry->status == mfrERR_NONE) ? strlen(entry->storage) : 0;
+}
+
+/**
+ * @brief Gather every mfrSerializedType_t once into the device identity snapshot
+ * @info The identity values are fixed for the life of the boot, so mfrGetSerializedData
+ *       serves them from memory instead of going back to the filesystem on every call.
+ * @return 0 on success, -1 on failure
+ */
+static int buildSerializedSnapshot(void)
+{
+    serializedSources_t sources = {0};
+    serializedSnapshot_t *snapshot = NULL;
+    mfrSerializedType_t type;
+
+    snapshot = (serializedSnapshot_t *)calloc(1, sizeof(serializedSnapshot_t));
+    if (!snapshot) {
+        mfrlib_log("buildSerializedSnapshot memory alloc error\n");
+        return -1;
+    }
+
+    /* each source file is parsed once for the whole pass */
+    for (type = mfrSERIALIZED_TYPE_MANUFACTURER; type < mfrSERIALIZED_TYPE_MAX; type++) {
+        uint64_t start = statsNow();
+        loadSerializedSnapshotEntry(type, &sources, &snapshot->entries[type]);
+        statsRecordSerializedType(type, start, snapshot->entries[type].status, 0);
+    }
+    releaseSources(&sources);
+
+    for (type = mfrSERIALIZED_TYPE_MANUFACTURER; type < mfrSERIALIZED_TYPE_MAX; type++) {
+        atomic_store(&serializedRetryNotBefore[type], 0);
+        atomic_store(&serializedRetryBackoff[type], SERIALIZED_RETRY_BACKOFF_MIN_NS);
+    }
+    atomic_store_explicit(&currentSnapshot, snapshot, memory_order_release);
+    return 0;
+}
+
+/**
+ * @brief Claim the re-read of an unavailable entry, at most once per backoff window
+ * @return 1 if the caller should read the source again, 0 to serve the cached failure
+ */
+static int claimSerializedRetry(mfrSerializedType_t param)
+{
+    uint64_t now = statsNow();
+    uint64_t notBefore = atomic_load(&serializedRetryNotBefore[param]);
+    uint64_t backoff;
+
+    if (now < notBefore) {
+        return 0;
+    }
+    backoff = atomic_load(&serializedRetryBackoff[param]);
+    /* only one of the threads racing for an expired window re-reads */
+    if (!atomic_compare_exchange_strong(&serializedRetryNotBefore[param], &notBefore, now + backoff)) {
+        return 0;
+    }
+    atomic_store(&serializedRetryBackoff[param],
+                 (2 * backoff < SERIALIZED_RETRY_BACKOFF_MAX_NS) ? 2 * backoff : SERIALIZED_RETRY_BACKOFF_MAX_NS);
+    return 1;
+}
+
+/**
+ * @brief Publish a new snapshot with the given entry re-read from its source
+ * @param param mfrSerializedType_t to re-read
+ * @param sources key/value sources used to read the entry
+ * @return the current snapshot after the update
+ */
+static serializedSnapshot_t *refreshSerializedSnapshotEntry(mfrSerializedType_t param, serializedSources_t *sources)
+{
+    serializedSnapshotEntry_t fresh;
+    serializedSnapshot_t *current = NULL;
+    serializedSnapshot_t *next = NULL;
+    mfrSerializedType_t type;
+
+    /* read outside the lock; only publishing is serialized */
+    loadSerializedSnapshotEntry(param, sources, &fresh);
+
+    pthread_mutex_lock(&snapshotWriteLock);
+    current = atomic_load_explicit(&currentSnapshot, memory_order_acquire);
+    if (fresh.status != mfrERR_NONE || current->entries[param].status == mfrERR_NONE) {
+        /* still unavailable, or another thread already published it */
+        pthread_mutex_unlock(&snapshotWriteLock);
+        return current;
+    }
+
+    next = (serializedSnapshot_t *)malloc(sizeof(serializedSnapshot_t));
+    if (!next) {
+        pthread_mutex_unlock(&snapshotWriteLock);
+        mfrlib_log("refreshSerializedSnapshotEntry memory alloc error\n");
+        return current;
+    }
+    memcpy(next, current, sizeof(serializedSnapshot_t));
+    next->entries[param] = fresh;
+    /* values held in storage must point into the new copy */
+    for (type = mfrSERIALIZED_TYPE_MANUFACTURER; type < mfrSERIALIZED_TYPE_MAX; type++) {
+        if (serializedTypeTable[type].cache != CACHE_STATIC) {
+            next->entries[type].value = next->entries[type].storage;
+        }
+    }
+    next->previous = current;
+    atomic_store_explicit(&currentSnapshot, next, memory_order_release);
+    pthread_mutex_unlock(&snapshotWriteLock);
+
+    return next;
+}
+
+/**
+ * @brief Drop the device identity snapshot and every superseded copy of it
+ */
+static void clearSerializedSnapshot(void)
+{
+    serializedSnapshot_t *snapshot = atomic_exchange(&currentSnapshot, NULL);
+
+    while (snapshot) {
+        serializedSnapshot_t *previous = snapshot->previous;
+        free(snapshot);
+        snapshot = previous;
+    }
+}
+
+/**
+ * @brief Get the device identity snapshot entry of the given mfrSerializedType_t
+ * @param param valid mfrSerializedType_t
+ * @param sources key/value sources used if the entry has to be read again
+ * @param entryOut snapshot entry on success
+ * @return status of the entry
+ */
+static mfrError_t getSerializedSnapshotEntry(mfrSerializedType_t param, serializedSources_t *sources, const serializedSnapshotEntry_t **entryOut)
+{
+    serializedSnapshot_t *snapshot = NULL;
+    uint64_t start = statsNow();
+    int cacheHit = 1;
+
+    if (param >= mfrSERIALIZED_TYPE_MAX) {
+        mfrlib_log("Unsupported mfrSerializedType_t '%d'\n", param);
+        return mfrERR_OPERATION_NOT_SUPPORTED;
+    }
+
+    snapshot = atomic_load_explicit(&currentSnapshot, memory_order_acquire);
+    if (!snapshot) {
+        statsRecordSerializedType(param, start, mfrERR_NOT_INITIALIZED, 0);
+        return mfrERR_NOT_INITIALIZED;
+    }
+    if (snapshot->entries[param].status == mfrERR_FLASH_READ_FAILED && serializedTypeTable[param].cache == CACHE_RETRY &&
+        claimSerializedRetry(param)) {
+        /* Source was not available at mfr_init (eg, interface not up yet); try again. */
+        snapshot = refreshSerializedSnapshotEntry(param, sources);
+        sources->refreshed++;
+        cacheHit = 0;
+    }
+    *entryOut = &snapshot->entries[param];
+    statsRecordSerializedType(param, start, (*entryOut)->status, cacheHit);
+    return (*entryOut)->status;
+}
+
+static mfrError_t getSerializedData(mfrSerializedType_t param, mfrSerializedData_t *data, int *cacheHit)
+{
+    const serializedSnapshotEntry_t *entry = NULL;
+    serializedSources_t sources = {0};
     mfrError_t ret = mfrERR_NONE;
 
     if (!isLibraryInitialized()) {
@@ -514,291 +1128,156 @@ mfrError_t mfrGetSerializedData(mfrSerializedType_t param, mfrSerializedData_t *
 
     data->bufLen = 0;
 
-    switch (param) {
-    case mfrSERIALIZED_TYPE_MANUFACTURER:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            /* retrieving tag MANUFACTURE from /etc/device.properties */
-            if (getValueMatchingKeyFromDevicePropertiesFile("MANUFACTURE", data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("Manufacturer= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getValueMatchingKeyFromDevicePropertiesFile failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
-        }
-        break;
-    /* unique identifier of the Manufacturer :: we are using the first 6 chars of the mac address */
-    case mfrSERIALIZED_TYPE_MANUFACTUREROUI:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            if (getManufacturerOUIHexString(data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("Manufacturer OUI= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getManufacturerOUIHexString failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
-        }
-        break;
-    case mfrSERIALIZED_TYPE_MODELNAME:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            /* retrieving tag DEVICE_NAME from /etc/device.properties */
-            if (getValueMatchingKeyFromDevicePropertiesFile("DEVICE_NAME", data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("Model Name= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getValueMatchingKeyFromDevicePropertiesFile failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
-        }
-        break;
-    case mfrSERIALIZED_TYPE_DESCRIPTION:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            /* Add description as 'RDKV Reference Device' */
-            strncpy(data->buf, defaultDescription, ((sizeof(defaultDescription) < MAX_BUF_LEN) ? sizeof(defaultDescription) : MAX_BUF_LEN));
-            data->bufLen = strlen(data->buf);
-            data->freeBuf = mfrFreeBuffer;
-            mfrlib_log("Description= '%s', len=%d\n", data->buf, data->bufLen);
-        }
-        break;
-    case mfrSERIALIZED_TYPE_PRODUCTCLASS:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            /* Add product class as 'RDKV' */
-            strncpy(data->buf, defaultProductClass, ((sizeof(defaultProductClass) < MAX_BUF_LEN) ? sizeof(defaultProductClass) : MAX_BUF_LEN));
-            data->bufLen = strlen(data->buf);
-            data->freeBuf = mfrFreeBuffer;
-            mfrlib_log("Product Class= '%s', len=%d\n", data->buf, data->bufLen);
-        }
-        break;
-    case mfrSERIALIZED_TYPE_SERIALNUMBER:
-    case mfrSERIALIZED_TYPE_MANUFACTURING_SERIALNUMBER:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            /* retrieving tag SERIAL_NUMBER from /etc/device.properties */
-            if (getValueMatchingKeyFromCPUINFO("Serial", data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("Serial Number= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getValueMatchingKeyFromCPUINFO failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
-        }
-        break;
-    case mfrSERIALIZED_TYPE_HARDWAREVERSION:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            /* retrieving tag REVISION from /etc/device.properties */
-            if (getValueMatchingKeyFromCPUINFO("Revision", data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("Hardware Version= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getValueMatchingKeyFromCPUINFO failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
-        }
-        break;
-    case mfrSERIALIZED_TYPE_DEVICEMAC:
-    case mfrSERIALIZED_TYPE_ETHERNETMAC:
-    case mfrSERIALIZED_TYPE_ESTBMAC:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            if (getInterfaceMACString("eth0", data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("Device MAC= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getInterfaceMACString failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
-        }
-        break;
-    case mfrSERIALIZED_TYPE_WIFIMAC:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            if (getInterfaceMACString("wlan0", data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("WiFi MAC= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getInterfaceMACString failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
-        }
-        break;
-    case mfrSERIALIZED_TYPE_SOFTWAREVERSION:
-        /* return defaultSoftwareVersion */
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            strncpy(data->buf, defaultSoftwareVersion, ((sizeof(defaultSoftwareVersion) < MAX_BUF_LEN) ? sizeof(defaultSoftwareVersion) : MAX_BUF_LEN));
-            data->bufLen = strlen(data->buf);
-            data->freeBuf = mfrFreeBuffer;
-            mfrlib_log("Software Version= '%s', len=%d\n", data->buf, data->bufLen);
-        }
-        break;
-    case mfrSERIALIZED_TYPE_MOCAMAC:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            /* get MOCA_INTERFACE from device.properties and retieve its MAC */
-            char mocaInterface[16] = {0};
-            if (getValueMatchingKeyFromDevicePropertiesFile("MOCA_INTERFACE", mocaInterface, sizeof(mocaInterface)) == 0) {
-                if (getInterfaceMACString(mocaInterface, data->buf, MAX_BUF_LEN) == 0) {
-                    data->bufLen = strlen(data->buf);
-                    data->freeBuf = mfrFreeBuffer;
-                    mfrlib_log("MOCA MAC= '%s', len=%d\n", data->buf, data->bufLen);
-                } else {
-                    mfrFreeBuffer(data->buf);
-                    mfrlib_log("getInterfaceMACString failed, return mfrERR_FLASH_READ_FAILED.\n");
-                    ret = mfrERR_FLASH_READ_FAILED;
-                }
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getValueMatchingKeyFromDevicePropertiesFile failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
-        }
-        break;
-    case mfrSERIALIZED_TYPE_BLUETOOTHMAC:
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            if (getBDAddress(data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("Bluetooth MAC= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getBDAddress failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
-        }
-        break;
-    case mfrSERIALIZED_TYPE_HWID:
-    case mfrSERIALIZED_TYPE_MODELNUMBER:
-        /* Read cpuinfo and use Revision */
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            if (getValueMatchingKeyFromCPUINFO("Revision", data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("HWID= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getValueMatchingKeyFromCPUINFO failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
-        }
-        break;
-    case mfrSERIALIZED_TYPE_SOC_ID:
-        /* Read cpuinfo and use Hardware */
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            if (getValueMatchingKeyFromCPUINFO("Hardware", data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("SOC ID= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getValueMatchingKeyFromCPUINFO failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
+    ret = getSerializedSnapshotEntry(param, &sources, &entry);
+    releaseSources(&sources);
+    *cacheHit = (sources.refreshed == 0);
+    if (ret != mfrERR_NONE) {
+        return ret;
+    }
+
+    data->buf = (char *)calloc(entry->len + 1, sizeof(char));
+    if (!data->buf) {
+        mfrlib_log("Memory alloc error\n");
+        return mfrERR_MEMORY_EXHAUSTED;
+    }
+    memcpy(data->buf, entry->value, entry->len);
+    data->bufLen = entry->len;
+    data->freeBuf = mfrFreeBuffer;
+    mfrlib_log("mfrGetSerializedData type '%d' = '%s', len=%zu\n", param, data->buf, data->bufLen);
+    return mfrERR_NONE;
+}
+
+mfrError_t mfrGetSerializedData(mfrSerializedType_t param, mfrSerializedData_t *data)
+{
+    uint64_t start = statsNow();
+    int cacheHit = 0;
+    mfrError_t ret = getSerializedData(param, data, &cacheHit);
+
+    statsRecordApi(mfrSTATS_API_GET_SERIALIZED_DATA, start, ret, cacheHit);
+    return ret;
+}
+
+static mfrError_t getSerializedDataToBuffer(mfrSerializedType_t type, char *buf, size_t bufSize, size_t *bufLen, int *cacheHit)
+{
+    const serializedSnapshotEntry_t *entry = NULL;
+    serializedSources_t sources = {0};
+    mfrError_t ret = mfrERR_NONE;
+
+    if (!isLibraryInitialized()) {
+        mfrlib_log("mfrGetSerializedDataToBuffer not initialized\n");
+        return mfrERR_NOT_INITIALIZED;
+    }
+
+    if (!bufLen || (!buf && bufSize) || !isValidMfrSerializedType(type)) {
+        mfrlib_log("mfrGetSerializedDataToBuffer invalid input\n");
+        return mfrERR_INVALID_PARAM;
+    }
+
+    *bufLen = 0;
+
+    ret = getSerializedSnapshotEntry(type, &sources, &entry);
+    releaseSources(&sources);
+    *cacheHit = (sources.refreshed == 0);
+    if (ret != mfrERR_NONE) {
+        return ret;
+    }
+
+    *bufLen = entry->len;
+    if (bufSize < entry->len + 1) {
+        mfrlib_log("mfrGetSerializedDataToBuffer type '%d' needs %zu bytes, got %zu\n", type, entry->len + 1, bufSize);
+        return mfrERR_MEMORY_EXHAUSTED;
+    }
+    memcpy(buf, entry->value, entry->len);
+    buf[entry->len] = '\0';
+    return mfrERR_NONE;
+}
+
+mfrError_t mfrGetSerializedDataToBuffer(mfrSerializedType_t type, char *buf, size_t bufSize, size_t *bufLen)
+{
+    uint64_t start = statsNow();
+    int cacheHit = 0;
+    mfrError_t ret = getSerializedDataToBuffer(type, buf, bufSize, bufLen, &cacheHit);
+
+    statsRecordApi(mfrSTATS_API_GET_SERIALIZED_DATA_TO_BUFFER, start, ret, cacheHit);
+    return ret;
+}
+
+static mfrError_t getSerializedDataBatch(const mfrSerializedType_t *types, size_t count,
+                                         mfrSerializedData_t *data, mfrError_t *status,
+                                         mfrSerializedBatch_t *batch, int *cacheHit)
+{
+    const serializedSnapshotEntry_t *entry = NULL;
+    const serializedSnapshot_t *snapshot = NULL;
+    serializedSources_t sources = {0};
+    size_t arenaLen = 0;
+    size_t offset = 0;
+    size_t i;
+
+    if (!isLibraryInitialized()) {
+        mfrlib_log("mfrGetSerializedDataBatch not initialized\n");
+        return mfrERR_NOT_INITIALIZED;
+    }
+
+    if (!types || !data || !status || !batch || count == 0) {
+        mfrlib_log("mfrGetSerializedDataBatch invalid input\n");
+        return mfrERR_INVALID_PARAM;
+    }
+
+    memset(batch, 0, sizeof(*batch));
+
+    /* Sources re-read for entries missing from the snapshot are shared by the whole batch. */
+    for (i = 0; i < count; i++) {
+        memset(&data[i], 0, sizeof(data[i]));
+        if (!isValidMfrSerializedType(types[i])) {
+            status[i] = mfrERR_INVALID_PARAM;
+            continue;
         }
-        break;
-    case mfrSERIALIZED_TYPE_IMAGENAME:
-        /* Read /version.txt and extract 'imagename' */
-        data->buf = (char *)calloc(MAX_BUF_LEN, sizeof(char));
-        if (!data->buf) {
-            mfrlib_log("Memory alloc error\n");
-            ret = mfrERR_MEMORY_EXHAUSTED;
-        } else {
-            if (getValueFromVersionFile("imagename", ':', data->buf, MAX_BUF_LEN) == 0) {
-                data->bufLen = strlen(data->buf);
-                data->freeBuf = mfrFreeBuffer;
-                mfrlib_log("Image Name= '%s', len=%d\n", data->buf, data->bufLen);
-            } else {
-                mfrFreeBuffer(data->buf);
-                mfrlib_log("getValueFromVersionFile failed, return mfrERR_FLASH_READ_FAILED.\n");
-                ret = mfrERR_FLASH_READ_FAILED;
-            }
+        status[i] = getSerializedSnapshotEntry(types[i], &sources, &entry);
+        if (status[i] == mfrERR_NONE) {
+            arenaLen += entry->len + 1;
         }
-        break;
-    case mfrSERIALIZED_TYPE_PROVISIONINGCODE:
-    case mfrSERIALIZED_TYPE_FIRSTUSEDATE:
-    case mfrSERIALIZED_TYPE_PDRIVERSION:
-    case mfrSERIALIZED_TYPE_HDMIHDCP:
-    case mfrSERIALIZED_TYPE_MAX:
-    case mfrSERIALIZED_TYPE_WPSPIN:
-    case mfrSERIALIZED_TYPE_RF4CEMAC:
-    case mfrSERIALIZED_TYPE_PROVISIONED_MODELNAME:
-    case mfrSERIALIZED_TYPE_PMI:
-    case mfrSERIALIZED_TYPE_IMAGETYPE:
-    case mfrSERIALIZED_TYPE_BLVERSION:
-    case mfrSERIALIZED_TYPE_REGION:
-    case mfrSERIALIZED_TYPE_BDRIVERSION:
-    case mfrSERIALIZED_TYPE_LED_WHITE_LEVEL:
-    case mfrSERIALIZED_TYPE_LED_PATTERN:
-    default:
-        /* Does not have any data. Report unsupported. */
-        mfrlib_log("Unsupported mfrSerializedType_t '%d'\n", param);
-        ret = mfrERR_OPERATION_NOT_SUPPORTED;
-        break;
     }
+    releaseSources(&sources);
+    *cacheHit = (sources.refreshed == 0);
+
+    if (arenaLen == 0) {
+        return mfrERR_NONE;
+    }
+
+    batch->arena = (char *)malloc(arenaLen);
+    if (!batch->arena) {
+        mfrlib_log("Memory alloc error\n");
+        return mfrERR_MEMORY_EXHAUSTED;
+    }
+    batch->arenaLen = arenaLen;
+    batch->freeArena = mfrFreeBuffer;
+
+    /* Entries that were available in the first pass are identical in any later snapshot. */
+    snapshot = atomic_load_explicit(&currentSnapshot, memory_order_acquire);
+    for (i = 0; i < count; i++) {
+        if (status[i] != mfrERR_NONE) {
+            continue;
+        }
+        entry = &snapshot->entries[types[i]];
+        data[i].buf = batch->arena + offset;
+        memcpy(data[i].buf, entry->value, entry->len);
+        data[i].buf[entry->len] = '\0';
+        data[i].bufLen = entry->len;
+        offset += entry->len + 1;
+    }
+    mfrlib_log("mfrGetSerializedDataBatch %zu types, arena len=%zu\n", count, arenaLen);
+    return mfrERR_NONE;
+}
+
+mfrError_t mfrGetSerializedDataBatch(const mfrSerializedType_t *types, size_t count,
+                                     mfrSerializedData_t *data, mfrError_t *status,
+                                     mfrSerializedBatch_t *batch)
+{
+    uint64_t start = statsNow();
+    int cacheHit = 0;
+    mfrError_t ret = getSerializedDataBatch(types, count, data, status, batch, &cacheHit);
+
+    statsRecordApi(mfrSTATS_API_GET_SERIALIZED_DATA_BATCH, start, ret, cacheHit);
     return ret;
 }
 
@@ -949,45 +1428,84 @@ bool isValidMfrImageType(mfrImageType_t type) {
     return false;
 }
 
-mfrError_t mfr_init(void)
+static mfrError_t initLibrary(void)
 {
-    configMFRLibLogging();
+    pthread_once(&logConfigOnce, initMFRLibLogging);
 
-    if (isInitialized) {
+    pthread_mutex_lock(&initLock);
+    if (atomic_load_explicit(&isInitialized, memory_order_relaxed)) {
+        pthread_mutex_unlock(&initLock);
         mfrlib_log("mfr_init already initialized\n");
         return mfrERR_ALREADY_INITIALIZED;
     }
 
 #ifdef ENABLE_SINGLE_INSTANCE_LOCK
     if (acquireLock() == -1) {
+        pthread_mutex_unlock(&initLock);
         mfrlib_log("mfr_init acquireLock failed\n");
         return mfrERR_ALREADY_INITIALIZED;
     }
 #endif /* ENABLE_SINGLE_INSTANCE_LOCK */
 
-    isInitialized = 1;
+    if (buildSerializedSnapshot() == -1) {
+#ifdef ENABLE_SINGLE_INSTANCE_LOCK
+        releaseLock();
+#endif /* ENABLE_SINGLE_INSTANCE_LOCK */
+        pthread_mutex_unlock(&initLock);
+        return mfrERR_MEMORY_EXHAUSTED;
+    }
+
+    atomic_store_explicit(&isInitialized, 1, memory_order_release);
+    pthread_mutex_unlock(&initLock);
     return mfrERR_NONE;
 }
 
-mfrError_t mfr_term(void)
+mfrError_t mfr_init(void)
 {
-    if (!isInitialized) {
+    uint64_t start = statsNow();
+    mfrError_t ret = initLibrary();
+
+    statsRecordApi(mfrSTATS_API_INIT, start, ret, 0);
+    return ret;
+}
+
+static mfrError_t termLibrary(void)
+{
+    pthread_mutex_lock(&initLock);
+    if (!atomic_load_explicit(&isInitialized, memory_order_relaxed)) {
+        pthread_mutex_unlock(&initLock);
         mfrlib_log("mfr_term not initialized\n");
         return mfrERR_NOT_INITIALIZED;
     }
 
 #ifdef ENABLE_SINGLE_INSTANCE_LOCK
     if (releaseLock() == -1) {
+        pthread_mutex_unlock(&initLock);
         mfrlib_log("mfr_term releaseLock failed\n");
         return mfrERR_NOT_INITIALIZED;
     }
 #endif /* ENABLE_SINGLE_INSTANCE_LOCK */
 
-    isInitialized = 0;
+    atomic_store_explicit(&isInitialized, 0, memory_order_release);
+    clearSerializedSnapshot();
+    pthread_mutex_unlock(&initLock);
+#ifdef THERMAL_PROTECTION_ENABLED
+    /* the sampler may have been started by mfrRegisterTempStateNotify; it must not outlive the library */
+    mfrStopTempSampler();
+#endif
     return mfrERR_NONE;
 }
 
-mfrError_t mfrWriteImage(const char *name,  const char *path, mfrImageType_t type,  mfrUpgradeStatusNotify_t notify)
+mfrError_t mfr_term(void)
+{
+    uint64_t start = statsNow();
+    mfrError_t ret = termLibrary();
+
+    statsRecordApi(mfrSTATS_API_TERM, start, ret, 0);
+    return ret;
+}
+
+static mfrError_t writeImage(const char *name,  const char *path, mfrImageType_t type,  mfrUpgradeStatusNotify_t notify)
 {
     if (!isLibraryInitialized()) {
         mfrlib_log("isLibraryInitialized not initialized\n");
@@ -998,8 +1516,21 @@ mfrError_t mfrWriteImage(const char *name,  const char *path, mfrImageType_t typ
         mfrlib_log("mfrWriteImage invalid input\n");
         return mfrERR_INVALID_PARAM;
     }
+#ifdef NATIVE_IMAGE_WRITE_ENABLED
+    return imageWrite(name, path, notify);
+#else
     // TODO: change FlashApp.sh logic to use mfrWriteImage
     return mfrERR_OPERATION_NOT_SUPPORTED;
+#endif
+}
+
+mfrError_t mfrWriteImage(const char *name,  const char *path, mfrImageType_t type,  mfrUpgradeStatusNotify_t notify)
+{
+    uint64_t start = statsNow();
+    mfrError_t ret = writeImage(name, path, type, notify);
+
+    statsRecordApi(mfrSTATS_API_WRITE_IMAGE, start, ret, 0);
+    return ret;
 }
 
 /****************************** MFR WIFI APIs ********************************/
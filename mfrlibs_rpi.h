@@ -0,0 +1,325 @@
+/*
+ * If not stated otherwise in this file or this component's LICENSE file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2024 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+/**
+ * @file mfrlibs_rpi.h
+ * @brief RPi MFR HAL extensions on top of the IARMMGRS MFR HAL interface
+ */
+
+#ifndef MFRLIBS_RPI_H
+#define MFRLIBS_RPI_H
+
+#include <stddef.h>
+#include "mfrTypes.h"
+#include "mfr_temperature.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Storage backing the strings returned by mfrGetSerializedDataBatch
+ */
+typedef struct _mfrSerializedBatch_t {
+    char *arena;                        /**< single allocation holding every returned string */
+    size_t arenaLen;                    /**< size of the arena in bytes */
+    void (*freeArena)(char *arena);     /**< releases the arena; NULL if nothing was allocated */
+} mfrSerializedBatch_t;
+
+/**
+* @brief Read several types of serialized data in one call
+*
+* @param [in] types:  array of serialized data types to read
+* @param [in] count:  number of entries in types, data and status
+* @param [out] data:  data[i] receives the value of types[i]; buf points into the batch
+*                     arena and freeBuf is NULL, so the entries must not be freed one by one
+* @param [out] status:  status[i] receives the mfrGetSerializedData error code for types[i]
+* @param [out] batch:  arena backing the returned strings; release it once with
+*                      batch->freeArena(batch->arena) when the freeArena is not NULL
+*
+* @return mfrERR_NONE if the batch was processed, even when some types failed; check status
+*         for the per-type result.
+*         mfrERR_NOT_INITIALIZED, mfrERR_INVALID_PARAM or mfrERR_MEMORY_EXHAUSTED otherwise.
+*/
+mfrError_t mfrGetSerializedDataBatch(const mfrSerializedType_t *types, size_t count,
+                                     mfrSerializedData_t *data, mfrError_t *status,
+                                     mfrSerializedBatch_t *batch);
+
+/**
+* @brief Read serialized data into a caller supplied buffer
+*
+* @param [in] type:  serialized data type to read
+* @param [out] buf:  buffer receiving the NUL terminated value; may be NULL when bufSize is 0
+* @param [in] bufSize:  size of buf in bytes
+* @param [out] bufLen:  length of the value, without the NUL terminator. It is also set when
+*                       buf is too small, so the caller can retry with bufLen + 1 bytes.
+*
+* @return mfrERR_NONE on success.
+*         mfrERR_MEMORY_EXHAUSTED if buf is too small to hold the value; buf is left untouched.
+*         Otherwise the same error codes as mfrGetSerializedData.
+*
+* @note Values are copied from the device identity snapshot without any heap allocation.
+*/
+mfrError_t mfrGetSerializedDataToBuffer(mfrSerializedType_t type, char *buf, size_t bufSize, size_t *bufLen);
+
+/*
+ * Call statistics; collected for every entry point listed in mfrStatsApi_t and for every
+ * mfrSerializedType_t read, from the first call or the last mfrResetStats.
+ */
+
+typedef enum _mfrStatsApi_t {
+    mfrSTATS_API_INIT = 0,
+    mfrSTATS_API_TERM,
+    mfrSTATS_API_GET_SERIALIZED_DATA,
+    mfrSTATS_API_GET_SERIALIZED_DATA_TO_BUFFER,
+    mfrSTATS_API_GET_SERIALIZED_DATA_BATCH,
+    mfrSTATS_API_WRITE_IMAGE,
+    mfrSTATS_API_GET_TEMPERATURE,
+    mfrSTATS_API_GET_TEMPERATURE_ZONES,
+    mfrSTATS_API_SET_TEMP_THRESHOLDS,
+    mfrSTATS_API_GET_TEMP_THRESHOLDS,
+    mfrSTATS_API_MAX
+} mfrStatsApi_t;
+
+#define MFR_STATS_LATENCY_BUCKETS 32
+
+/**
+ * @brief Counters of one entry point or serialized data type
+ */
+typedef struct _mfrStatsCounters_t {
+    unsigned long long calls;           /**< number of calls */
+    unsigned long long errors;          /**< calls that did not return mfrERR_NONE */
+    unsigned long long cacheHits;       /**< calls served from memory without reading the source */
+    unsigned long long totalNs;         /**< sum of the call latencies in nanoseconds */
+    unsigned long long maxNs;           /**< highest call latency in nanoseconds */
+    unsigned long long latency[MFR_STATS_LATENCY_BUCKETS];  /**< latency[i] counts calls that took
+                                                                 [2^i, 2^(i+1)) ns; the last bucket
+                                                                 also counts all slower calls */
+} mfrStatsCounters_t;
+
+/**
+* @brief Get the counters of an entry point
+*
+* For mfrGetSerializedData and its extensions a call is a cache hit when every type it
+* returned came from the device identity snapshot. For the temperature reads it is a cache
+* hit when the reading came from the background sampler.
+*
+* @param [in] api:  entry point
+* @param [out] stats:  counters of the entry point
+*
+* @return mfrERR_NONE on success, mfrERR_INVALID_PARAM if an argument is invalid.
+*/
+mfrError_t mfrGetApiStats(mfrStatsApi_t api, mfrStatsCounters_t *stats);
+
+/**
+* @brief Get the counters of a serialized data type
+*
+* Every read of the type is counted: the read from its source by mfr_init, and every lookup
+* by mfrGetSerializedData and its extensions. The latency is the time taken to resolve the
+* value, not the whole API call.
+*
+* @param [in] type:  serialized data type
+* @param [out] stats:  counters of the type
+*
+* @return mfrERR_NONE on success, mfrERR_INVALID_PARAM if an argument is invalid.
+*/
+mfrError_t mfrGetSerializedTypeStats(mfrSerializedType_t type, mfrStatsCounters_t *stats);
+
+/**
+* @brief Reset every entry point and serialized data type counter to zero
+*/
+void mfrResetStats(void);
+
+/*
+ * Thermal extensions; available when the library is built with --enable-thermalprotection.
+ */
+
+#define MFR_THERMAL_ZONE_NAME_LEN 48
+
+/**
+ * @brief Reading of one temperature sensor on the board
+ */
+typedef struct _mfrThermalZone_t {
+    char name[MFR_THERMAL_ZONE_NAME_LEN];   /**< thermal zone type, or hwmon "name/label" */
+    int milliCelsius;                       /**< temperature in millidegrees Celsius */
+    int valid;                              /**< 0 if the sensor could not be read */
+    int isCore;                             /**< sensor reported by mfrGetTemperature */
+    int isWifi;                             /**< sensor reported as wifiTemp by mfrGetTemperature */
+} mfrThermalZone_t;
+
+/**
+* @brief Read every thermal zone and hwmon temperature sensor on the board
+*
+* Sensors are discovered once and read in one pass over persistent sysfs fds, or taken from
+* the background sampler when it runs.
+*
+* @param [out] zones:  array receiving one reading per sensor
+* @param [in] maxZones:  number of entries in zones
+* @param [out] zoneCount:  number of entries filled
+*
+* @return mfrERR_NONE on success.
+*         mfrERR_INVALID_PARAM if an argument is invalid.
+*         mfrERR_TEMP_READ_FAILED if no temperature sensor was found.
+*/
+mfrError_t mfrGetTemperatureZones(mfrThermalZone_t *zones, int maxZones, int *zoneCount);
+
+/**
+* @brief Start the background temperature sampler
+*
+* The sampler reads every temperature sensor every intervalMs. While it runs,
+* mfrGetTemperature and mfrGetTemperatureZones return the latest samples from memory
+* without any syscall.
+*
+* @param [in] intervalMs:  sampling interval in milliseconds; must not be 0
+*
+* @return mfrERR_NONE on success.
+*         mfrERR_INVALID_PARAM if intervalMs is 0.
+*         mfrERR_ALREADY_INITIALIZED if the sampler is already running.
+*         mfrERR_GENERAL if the sampler thread could not be started.
+*/
+mfrError_t mfrStartTempSampler(unsigned int intervalMs);
+
+/**
+* @brief Stop the background temperature sampler started by mfrStartTempSampler
+*
+* mfr_term stops the sampler too.
+*
+* @return mfrERR_NONE on success, mfrERR_NOT_INITIALIZED if the sampler is not running.
+*/
+mfrError_t mfrStopTempSampler(void);
+
+/**
+ * @brief Called by the sampler thread when the core temperature moves to another state
+ *
+ * Callbacks must not stop the sampler. A call to mfrStopTempSampler from a callback only
+ * tells the sampler thread to exit once the callback returns; the thread is not joined.
+ *
+ * @param [in] newState:  state the core temperature moved to
+ * @param [in] oldState:  state before the transition
+ * @param [in] temperature:  core temperature in degrees Celsius that caused the transition
+ * @param [in] cbData:  data passed to mfrRegisterTempStateNotify
+ */
+typedef void (*mfrTempStateNotify_t)(mfrTemperatureState_t newState, mfrTemperatureState_t oldState,
+                                     int temperature, void *cbData);
+
+/**
+* @brief Register for temperature state transition notifications
+*
+* The thresholds and hysteresis belong to this listener only; they do not change
+* mfrGetTemperature or the thresholds of other listeners. A state is entered as soon as its
+* threshold is reached and left only once the temperature drops hysteresis degrees below it.
+* The state starts at mfrTEMPERATURE_NORMAL whenever the sampler starts. Transitions are
+* detected by the background sampler, which is started with a one second interval if it is
+* not running yet. Thermal trip point uevents trigger an extra sample when the kernel sends
+* them.
+*
+* @param [in] cb:  callback; runs on the sampler thread and must not block
+* @param [in] cbData:  data passed back to cb
+* @param [in] tempHigh:  threshold in degrees Celsius for mfrTEMPERATURE_HIGH
+* @param [in] tempCritical:  threshold in degrees Celsius for mfrTEMPERATURE_CRITICAL
+* @param [in] hysteresis:  degrees Celsius below a threshold before its state is left
+*
+* @return mfrERR_NONE on success.
+*         mfrERR_INVALID_PARAM if an argument is invalid.
+*         mfrERR_MEMORY_EXHAUSTED if too many listeners are registered.
+*         mfrERR_GENERAL if the sampler could not be started.
+*/
+mfrError_t mfrRegisterTempStateNotify(mfrTempStateNotify_t cb, void *cbData, int tempHigh, int tempCritical, int hysteresis);
+
+/**
+* @brief Remove a listener added by mfrRegisterTempStateNotify
+*
+* The sampler keeps running; stop it with mfrStopTempSampler when it is no longer needed.
+*
+* @return mfrERR_NONE on success, mfrERR_INVALID_PARAM if the listener is not registered.
+*/
+mfrError_t mfrUnregisterTempStateNotify(mfrTempStateNotify_t cb, void *cbData);
+
+#define MFR_TEMP_HISTORY_MAX_WINDOWS 4
+
+/**
+ * @brief One core temperature sample held in the library history
+ */
+typedef struct _mfrTempSample_t {
+    unsigned long long timestampMs;     /**< CLOCK_MONOTONIC time of the sample in milliseconds */
+    int milliCelsius;                   /**< core temperature in millidegrees Celsius */
+} mfrTempSample_t;
+
+/**
+ * @brief Rolling statistics of the core temperature over one window
+ */
+typedef struct _mfrTempHistoryStats_t {
+    unsigned int windowSec;             /**< length of the window in seconds */
+    int samples;                        /**< number of samples in the window */
+    int minMilliCelsius;                /**< lowest sample in the window */
+    int maxMilliCelsius;                /**< highest sample in the window */
+    int meanMilliCelsius;               /**< mean of the samples in the window */
+    int milliCelsiusPerMinute;          /**< rate of change; least squares slope over the window */
+    unsigned int spanMs;                /**< time between the oldest and the newest sample */
+} mfrTempHistoryStats_t;
+
+/**
+* @brief Copy the most recent core temperature samples recorded by the sampler
+*
+* The sampler keeps the last 1024 samples in a ring buffer. Samples are copied without
+* taking a lock.
+*
+* @param [out] samples:  array receiving the samples, oldest first
+* @param [in] maxSamples:  number of entries in samples
+* @param [out] sampleCount:  number of entries filled; 0 if the sampler never ran
+*
+* @return mfrERR_NONE on success, mfrERR_INVALID_PARAM if an argument is invalid.
+*/
+mfrError_t mfrGetTempHistory(mfrTempSample_t *samples, int maxSamples, int *sampleCount);
+
+/**
+* @brief Get the rolling core temperature statistics of every configured window
+*
+* The statistics are updated incrementally by the sampler thread on every sample, so this
+* call only copies them. Windows longer than the history are limited to the samples it holds;
+* see spanMs.
+*
+* @param [out] stats:  array receiving one entry per window, in configuration order
+* @param [in] maxWindows:  number of entries in stats
+* @param [out] windowCount:  number of entries filled
+*
+* @return mfrERR_NONE on success.
+*         mfrERR_INVALID_PARAM if an argument is invalid.
+*         mfrERR_NOT_INITIALIZED if the sampler has not recorded any sample yet.
+*/
+mfrError_t mfrGetTempHistoryStats(mfrTempHistoryStats_t *stats, int maxWindows, int *windowCount);
+
+/**
+* @brief Configure the windows reported by mfrGetTempHistoryStats
+*
+* The default windows are 60, 300 and 900 seconds. The new windows are filled from the
+* samples already recorded and take effect with the next sample.
+*
+* @param [in] windowSec:  window lengths in seconds; none may be 0
+* @param [in] count:  number of windows, up to MFR_TEMP_HISTORY_MAX_WINDOWS
+*
+* @return mfrERR_NONE on success, mfrERR_INVALID_PARAM if an argument is invalid.
+*/
+mfrError_t mfrSetTempHistoryWindows(const unsigned int *windowSec, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MFRLIBS_RPI_H */
@@ -17,11 +17,705 @@
  * limitations under the License.
 */
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <linux/netlink.h>
 #include "mfr_temperature.h"
+#include "mfrlibs_rpi.h"
+#include "mfrlib_stats.h"
+#include "mfrlib_root.h"
 
-static int g_iTempThresholdHigh = 60;
-static int g_iTempThresholdCritical = 75;
+#define THERMAL_CLASS_DIR "/sys/class/thermal"
+#define HWMON_CLASS_DIR "/sys/class/hwmon"
+#define CORE_THERMAL_ZONE "thermal_zone0"
+#define MAX_THERMAL_SENSORS 16
+#define MAX_TEMP_NOTIFY 8
+#define DEFAULT_SAMPLER_INTERVAL_MS 1000
+#define TEMP_INVALID INT64_MIN
+#define TEMP_HISTORY_SIZE 1024          /* power of two; ~17 minutes at the default interval */
+#define TEMP_HISTORY_MASK (TEMP_HISTORY_SIZE - 1)
+
+/* High and critical thresholds packed in one word so readers always see a consistent pair */
+#define PACK_THRESHOLDS(high, critical) (((uint64_t)(uint32_t)(high) << 32) | (uint32_t)(critical))
+#define THRESHOLD_HIGH(packed)          ((int)(int32_t)(uint32_t)((packed) >> 32))
+#define THRESHOLD_CRITICAL(packed)      ((int)(int32_t)(uint32_t)(packed))
+
+static _Atomic uint64_t g_tempThresholds = PACK_THRESHOLDS(60, 75);
+
+/* Temperature sensors discovered once; each sysfs node stays open and is re-read with pread */
+typedef struct {
+    char name[MFR_THERMAL_ZONE_NAME_LEN];
+    int fd;
+} thermalSensor_t;
+
+static pthread_once_t g_discoverOnce = PTHREAD_ONCE_INIT;
+static thermalSensor_t g_sensors[MAX_THERMAL_SENSORS];
+static int g_iSensorCount = 0;
+static int g_iCoreSensor = -1;
+static int g_iWifiSensor = -1;
+
+/* Sensor names that identify the Wi-Fi chipset */
+static const char *wifiSensorNames[] = { "wifi", "wlan", "brcmf", "cyw43", NULL };
+
+/* Background sampler; the latest reading of every sensor in millidegrees Celsius, published
+ * under a sequence counter so readers get a consistent set without blocking */
+static pthread_mutex_t g_samplerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t g_samplerThread;
+static int g_samplerStopFd = -1;
+static int g_samplerTimerFd = -1;
+static atomic_int g_samplerRunning = 0;
+static int g_samplerUeventFd = -1;
+static atomic_int g_samplerStop = 0;
+/* set on the sampler thread when a listener stopped it; the thread then cleans up after itself */
+static __thread int t_samplerDetached = 0;
+static atomic_uint g_readingSeq = 0;
+static _Atomic int64_t g_readings[MAX_THERMAL_SENSORS];
+
+/* Temperature state listeners, notified by the sampler thread on state transitions.
+ * Each listener has its own thresholds, hysteresis and last reported state. */
+typedef struct {
+    mfrTempStateNotify_t cb;
+    void *cbData;
+    uint64_t thresholds;
+    int hysteresis;
+    mfrTemperatureState_t state;
+} tempStateListener_t;
+
+typedef struct {
+    mfrTempStateNotify_t cb;
+    void *cbData;
+    mfrTemperatureState_t state;
+    mfrTemperatureState_t previous;
+} tempStateEvent_t;
+
+static pthread_mutex_t g_notifyLock = PTHREAD_MUTEX_INITIALIZER;
+static tempStateListener_t g_listeners[MAX_TEMP_NOTIFY];
+static int g_iListenerCount = 0;
+
+/*
+ * Core temperature history. The sampler thread is the only writer; each slot packs the
+ * CLOCK_MONOTONIC time in ms (40 bits) and the reading in millidegrees (24 bits), so readers
+ * copy samples without a lock.
+ */
+#define PACK_SAMPLE(ms, milliCelsius) (((uint64_t)(ms) << 24) | ((uint32_t)(milliCelsius) & 0xFFFFFFu))
+#define SAMPLE_TIME(packed)           ((int64_t)((packed) >> 24))
+#define SAMPLE_VALUE(packed)          ((int)((int32_t)((uint32_t)(packed) << 8) >> 8))
+
+static _Atomic uint64_t g_history[TEMP_HISTORY_SIZE];
+static _Atomic uint64_t g_historyHead = 0;
+
+/* Rolling statistics of one window, updated by the sampler thread as samples come and go */
+typedef struct {
+    uint32_t seq;
+    int value;
+} historyExtreme_t;
+
+typedef struct {
+    int64_t windowMs;
+    uint64_t first;                     /* sequence number of the oldest sample in the window */
+    int count;
+    int64_t base;                       /* time of the oldest sample; the sums are relative to it */
+    int64_t sumT;
+    int64_t sumT2;
+    int64_t sumV;
+    int64_t sumTV;
+    historyExtreme_t minQueue[TEMP_HISTORY_SIZE];   /* monotonic queues; the front is the extreme */
+    historyExtreme_t maxQueue[TEMP_HISTORY_SIZE];
+    unsigned int minHead, minTail;
+    unsigned int maxHead, maxTail;
+} historyWindow_t;
+
+static historyWindow_t g_historyWindows[MFR_TEMP_HISTORY_MAX_WINDOWS];
+static int g_iHistoryWindowCount = 0;
+static unsigned int g_uHistoryAppliedGen = 0;
+
+/* Window configuration, applied by the sampler thread on its next sample */
+static pthread_mutex_t g_historyLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int g_historyWindowSec[MFR_TEMP_HISTORY_MAX_WINDOWS] = { 60, 300, 900 };
+static int g_iHistoryConfigCount = 3;
+static atomic_uint g_historyConfigGen = 1;
+
+/* Statistics published for lock-free readers */
+enum {
+    STAT_WINDOW_SEC,
+    STAT_SAMPLES,
+    STAT_MIN,
+    STAT_MAX,
+    STAT_MEAN,
+    STAT_RATE,
+    STAT_SPAN,
+    STAT_FIELDS
+};
+static atomic_uint g_historyStatsSeq = 0;
+static atomic_int g_iHistoryStatsCount = 0;
+static _Atomic int64_t g_historyStats[MFR_TEMP_HISTORY_MAX_WINDOWS][STAT_FIELDS];
+
+/**
+* @brief Read a one line sysfs attribute, stripping the trailing newline
+*
+* @return 0 on success, -1 on failure
+*/
+static int readSysfsString(const char *path, char *buf, size_t size)
+{
+    ssize_t len;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if( fd == -1 )
+        return -1;
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if( len <= 0 )
+        return -1;
+
+    buf[len] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/**
+* @brief Open the given temperature node and add it to the sensor table
+*
+* @return index of the sensor, or -1 on failure
+*/
+static int addSensor(const char *name, const char *tempPath)
+{
+    int fd;
+
+    if( g_iSensorCount >= MAX_THERMAL_SENSORS )
+        return -1;
+
+    fd = open(tempPath, O_RDONLY | O_CLOEXEC);
+    if( fd == -1 )
+        return -1;
+
+    snprintf(g_sensors[g_iSensorCount].name, sizeof(g_sensors[0].name), "%s", name);
+    g_sensors[g_iSensorCount].fd = fd;
+    if( g_iWifiSensor == -1 )
+    {
+        for( int i = 0; wifiSensorNames[i]; i++ )
+        {
+            if( strstr(name, wifiSensorNames[i]) )
+            {
+                g_iWifiSensor = g_iSensorCount;
+                break;
+            }
+        }
+    }
+    return g_iSensorCount++;
+}
+
+/**
+* @brief Check whether a sensor of the given name was already added
+*
+* '-' and '_' compare equal, as the kernel replaces '-' with '_' in hwmon names; the hwmon
+* mirror of the cpu-thermal zone is named cpu_thermal.
+*/
+static int isKnownSensor(const char *name)
+{
+    for( int i = 0; i < g_iSensorCount; i++ )
+    {
+        const char *a = g_sensors[i].name;
+        const char *b = name;
+
+        while( *a && (*a == *b || ((*a == '-' || *a == '_') && (*b == '-' || *b == '_'))) )
+        {
+            a++;
+            b++;
+        }
+        if( *a == '\0' && *b == '\0' )
+            return 1;
+    }
+    return 0;
+}
+
+/**
+* @brief Find every thermal zone and hwmon temperature input on the board
+*
+* hwmon devices that mirror a thermal zone of the same name (up to '-' and '_') are skipped.
+*/
+static void discoverSensors(void)
+{
+    char path[PATH_MAX];
+    char name[MFR_THERMAL_ZONE_NAME_LEN];
+    char thermalBuf[256];
+    char hwmonBuf[256];
+    const char *thermalDir = rootedPath(THERMAL_CLASS_DIR, thermalBuf, sizeof(thermalBuf));
+    const char *hwmonDir = rootedPath(HWMON_CLASS_DIR, hwmonBuf, sizeof(hwmonBuf));
+    struct dirent *entry = NULL;
+    DIR *dir = opendir(thermalDir);
+
+    if( dir != NULL )
+    {
+        while( (entry = readdir(dir)) != NULL )
+        {
+            int index;
+            if( strncmp(entry->d_name, "thermal_zone", 12) != 0 )
+                continue;
+            snprintf(path, sizeof(path), "%s/%s/type", thermalDir, entry->d_name);
+            if( readSysfsString(path, name, sizeof(name)) != 0 )
+                snprintf(name, sizeof(name), "%.*s", (int)sizeof(name) - 1, entry->d_name);
+            snprintf(path, sizeof(path), "%s/%s/temp", thermalDir, entry->d_name);
+            index = addSensor(name, path);
+            if( index != -1 && strcmp(entry->d_name, CORE_THERMAL_ZONE) == 0 )
+                g_iCoreSensor = index;
+        }
+        closedir(dir);
+    }
+
+    dir = opendir(hwmonDir);
+    if( dir != NULL )
+    {
+        while( (entry = readdir(dir)) != NULL )
+        {
+            char hwmonName[MFR_THERMAL_ZONE_NAME_LEN];
+            char label[MFR_THERMAL_ZONE_NAME_LEN];
+            if( strncmp(entry->d_name, "hwmon", 5) != 0 )
+                continue;
+            snprintf(path, sizeof(path), "%s/%s/name", hwmonDir, entry->d_name);
+            if( readSysfsString(path, hwmonName, sizeof(hwmonName)) != 0 || isKnownSensor(hwmonName) )
+                continue;
+            for( int input = 1; input <= 8; input++ )
+            {
+                snprintf(path, sizeof(path), "%s/%s/temp%d_label", hwmonDir, entry->d_name, input);
+                if( readSysfsString(path, label, sizeof(label)) != 0 )
+                    snprintf(label, sizeof(label), "temp%d", input);
+                snprintf(name, sizeof(name), "%.23s/%.23s", hwmonName, label);
+                snprintf(path, sizeof(path), "%s/%s/temp%d_input", hwmonDir, entry->d_name, input);
+                addSensor(name, path);
+            }
+        }
+        closedir(dir);
+    }
+
+    if( g_iCoreSensor == -1 && g_iSensorCount > 0 )
+        g_iCoreSensor = 0;
+
+    for( int i = 0; i < MAX_THERMAL_SENSORS; i++ )
+        atomic_init(&g_readings[i], TEMP_INVALID);
+}
+
+/**
+* @brief Read the given sensor from its persistent sysfs fd
+*
+* @param [in] index:  sensor index in the sensor table
+* @param [out] milliCelsius:  temperature in millidegrees Celsius
+*
+* @return 0 on success, -1 on failure
+*/
+static int readSensor(int index, int64_t *milliCelsius)
+{
+    char buf[32];
+    char *end = NULL;
+    ssize_t len;
+    long value;
+
+    if( index < 0 || index >= g_iSensorCount )
+        return -1;
+
+    len = pread(g_sensors[index].fd, buf, sizeof(buf) - 1, 0);
+    if( len <= 0 )
+        return -1;
+    buf[len] = '\0';
+
+    value = strtol(buf, &end, 10);
+    if( end == buf )
+        return -1;
+
+    *milliCelsius = value;
+    return 0;
+}
+
+/**
+* @brief Read every sensor in one pass over the persistent fds
+*
+* @param [out] readings:  one reading per sensor; TEMP_INVALID when the read failed
+*/
+static void readAllSensors(int64_t *readings)
+{
+    for( int i = 0; i < g_iSensorCount; i++ )
+    {
+        if( readSensor(i, &readings[i]) != 0 )
+            readings[i] = TEMP_INVALID;
+    }
+}
+
+/**
+* @brief Publish a full set of readings for lock-free readers
+*/
+static void publishReadings(const int64_t *readings)
+{
+    atomic_fetch_add_explicit(&g_readingSeq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for( int i = 0; i < g_iSensorCount; i++ )
+        atomic_store_explicit(&g_readings[i], readings[i], memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_readingSeq, 1, memory_order_release);
+}
+
+/**
+* @brief Get the latest readings, from the sampler when it runs or straight from sysfs
+*
+* @param [out] readings:  one reading per sensor
+*
+* @return 1 if the readings came from the sampler, 0 if they were read from sysfs
+*/
+static int getReadings(int64_t *readings)
+{
+    unsigned int seq;
+
+    if( !atomic_load_explicit(&g_samplerRunning, memory_order_acquire) )
+    {
+        readAllSensors(readings);
+        return 0;
+    }
+
+    do
+    {
+        seq = atomic_load_explicit(&g_readingSeq, memory_order_acquire);
+        for( int i = 0; i < g_iSensorCount; i++ )
+            readings[i] = atomic_load_explicit(&g_readings[i], memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while( (seq & 1) || seq != atomic_load_explicit(&g_readingSeq, memory_order_relaxed) );
+
+    if( g_iCoreSensor != -1 && readings[g_iCoreSensor] == TEMP_INVALID )
+    {
+        /* sampler has not produced a reading yet */
+        readAllSensors(readings);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+* @brief Classify a temperature against the thresholds
+*/
+static mfrTemperatureState_t classifyTemperature(int value, uint64_t thresholds)
+{
+    if( value >= THRESHOLD_CRITICAL(thresholds) )
+        return mfrTEMPERATURE_CRITICAL;
+    if( value >= THRESHOLD_HIGH(thresholds) )
+        return mfrTEMPERATURE_HIGH;
+    return mfrTEMPERATURE_NORMAL;
+}
+
+/**
+* @brief Notify the listeners whose core temperature state changed
+*
+* Every listener is classified against its own thresholds. Rising transitions happen as soon
+* as a threshold is reached. Falling transitions need the temperature to drop hysteresis
+* degrees below the threshold, so a reading hovering around a threshold does not flap.
+*/
+static void notifyTempState(const int64_t *readings)
+{
+    tempStateEvent_t events[MAX_TEMP_NOTIFY];
+    int count = 0;
+    int value;
+
+    if( g_iCoreSensor == -1 || readings[g_iCoreSensor] == TEMP_INVALID )
+        return;
+
+    value = (int)(readings[g_iCoreSensor] / 1000);
+
+    pthread_mutex_lock(&g_notifyLock);
+    for( int i = 0; i < g_iListenerCount; i++ )
+    {
+        tempStateListener_t *listener = &g_listeners[i];
+        mfrTemperatureState_t previous = listener->state;
+        mfrTemperatureState_t rising = classifyTemperature(value, listener->thresholds);
+        mfrTemperatureState_t falling = classifyTemperature(value + listener->hysteresis, listener->thresholds);
+        mfrTemperatureState_t state;
+
+        if( rising >= previous )
+            state = rising;
+        else
+            state = (falling < previous) ? falling : previous;
+
+        if( state == previous )
+            continue;
+        listener->state = state;
+        events[count].cb = listener->cb;
+        events[count].cbData = listener->cbData;
+        events[count].state = state;
+        events[count].previous = previous;
+        count++;
+    }
+    pthread_mutex_unlock(&g_notifyLock);
+
+    /* call out without the lock so a listener may unregister itself */
+    for( int i = 0; i < count; i++ )
+        events[i].cb(events[i].state, events[i].previous, value, events[i].cbData);
+}
+
+static int64_t monotonicMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+* @brief Move the time base of the window sums to the given time
+*/
+static void rebaseHistoryWindow(historyWindow_t *w, int64_t base)
+{
+    int64_t d = base - w->base;
+
+    /* sum((t-d)^2) = sum(t^2) - 2d*sum(t) + n*d^2, and so on */
+    w->sumT2 += (int64_t)w->count * d * d - 2 * d * w->sumT;
+    w->sumTV -= d * w->sumV;
+    w->sumT -= (int64_t)w->count * d;
+    w->base = base;
+}
+
+static void dropOldestHistorySample(historyWindow_t *w, uint64_t packed)
+{
+    int64_t t = SAMPLE_TIME(packed) - w->base;
+    int v = SAMPLE_VALUE(packed);
+
+    w->sumT -= t;
+    w->sumT2 -= t * t;
+    w->sumV -= v;
+    w->sumTV -= t * v;
+    if( w->minHead != w->minTail && w->minQueue[w->minHead & TEMP_HISTORY_MASK].seq == (uint32_t)w->first )
+        w->minHead++;
+    if( w->maxHead != w->maxTail && w->maxQueue[w->maxHead & TEMP_HISTORY_MASK].seq == (uint32_t)w->first )
+        w->maxHead++;
+    w->first++;
+    w->count--;
+}
+
+/**
+* @brief Add a sample to a window, dropping the samples that fell out of it
+*
+* Runs in constant amortized time: the sums are updated in place and min/max come from
+* monotonic queues, so the history is never rescanned.
+*/
+static void addHistorySample(historyWindow_t *w, uint64_t seq, int64_t now, int value)
+{
+    historyExtreme_t sample = { (uint32_t)seq, value };
+    int64_t t;
+
+    /* slot seq - TEMP_HISTORY_SIZE is about to be reused, so its sample has to go too */
+    while( w->count > 0 )
+    {
+        uint64_t packed = atomic_load_explicit(&g_history[w->first & TEMP_HISTORY_MASK], memory_order_relaxed);
+        if( w->first + TEMP_HISTORY_SIZE > seq && SAMPLE_TIME(packed) > now - w->windowMs )
+            break;
+        dropOldestHistorySample(w, packed);
+    }
+
+    if( w->count == 0 )
+    {
+        w->first = seq;
+        w->base = now;
+        w->sumT = w->sumT2 = w->sumV = w->sumTV = 0;
+        w->minHead = w->minTail = w->maxHead = w->maxTail = 0;
+    }
+    else
+    {
+        rebaseHistoryWindow(w, SAMPLE_TIME(atomic_load_explicit(&g_history[w->first & TEMP_HISTORY_MASK], memory_order_relaxed)));
+    }
+
+    t = now - w->base;
+    w->sumT += t;
+    w->sumT2 += t * t;
+    w->sumV += value;
+    w->sumTV += t * value;
+    w->count++;
+
+    while( w->minTail != w->minHead && w->minQueue[(w->minTail - 1) & TEMP_HISTORY_MASK].value >= value )
+        w->minTail--;
+    w->minQueue[w->minTail++ & TEMP_HISTORY_MASK] = sample;
+    while( w->maxTail != w->maxHead && w->maxQueue[(w->maxTail - 1) & TEMP_HISTORY_MASK].value <= value )
+        w->maxTail--;
+    w->maxQueue[w->maxTail++ & TEMP_HISTORY_MASK] = sample;
+}
+
+/**
+* @brief Apply a new window configuration, replaying the samples still held in the history
+*/
+static void applyHistoryWindows(unsigned int gen)
+{
+    uint64_t head = atomic_load_explicit(&g_historyHead, memory_order_relaxed);
+    uint64_t seq = (head > TEMP_HISTORY_SIZE) ? head - TEMP_HISTORY_SIZE : 0;
+
+    pthread_mutex_lock(&g_historyLock);
+    g_iHistoryWindowCount = g_iHistoryConfigCount;
+    for( int i = 0; i < g_iHistoryWindowCount; i++ )
+    {
+        g_historyWindows[i].windowMs = (int64_t)g_historyWindowSec[i] * 1000;
+        g_historyWindows[i].count = 0;
+    }
+    pthread_mutex_unlock(&g_historyLock);
+
+    for( ; seq < head; seq++ )
+    {
+        uint64_t packed = atomic_load_explicit(&g_history[seq & TEMP_HISTORY_MASK], memory_order_relaxed);
+        for( int i = 0; i < g_iHistoryWindowCount; i++ )
+            addHistorySample(&g_historyWindows[i], seq, SAMPLE_TIME(packed), SAMPLE_VALUE(packed));
+    }
+    g_uHistoryAppliedGen = gen;
+}
+
+/**
+* @brief Publish the statistics of every window for lock-free readers
+*
+* @param [in] now:  time of the newest sample
+*/
+static void publishHistoryStats(int64_t now)
+{
+    atomic_fetch_add_explicit(&g_historyStatsSeq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for( int i = 0; i < g_iHistoryWindowCount; i++ )
+    {
+        const historyWindow_t *w = &g_historyWindows[i];
+        _Atomic int64_t *stats = g_historyStats[i];
+        double n = w->count;
+        double denom = n * (double)w->sumT2 - (double)w->sumT * (double)w->sumT;
+        int64_t rate = 0;
+
+        /* least squares slope, in millidegrees per ms, scaled to per minute */
+        if( w->count > 1 && denom > 0 )
+            rate = (int64_t)((n * (double)w->sumTV - (double)w->sumT * (double)w->sumV) / denom * 60000.0);
+
+        atomic_store_explicit(&stats[STAT_WINDOW_SEC], w->windowMs / 1000, memory_order_relaxed);
+        atomic_store_explicit(&stats[STAT_SAMPLES], w->count, memory_order_relaxed);
+        atomic_store_explicit(&stats[STAT_MIN], w->minQueue[w->minHead & TEMP_HISTORY_MASK].value, memory_order_relaxed);
+        atomic_store_explicit(&stats[STAT_MAX], w->maxQueue[w->maxHead & TEMP_HISTORY_MASK].value, memory_order_relaxed);
+        atomic_store_explicit(&stats[STAT_MEAN], w->sumV / w->count, memory_order_relaxed);
+        atomic_store_explicit(&stats[STAT_RATE], rate, memory_order_relaxed);
+        atomic_store_explicit(&stats[STAT_SPAN], now - w->base, memory_order_relaxed);
+    }
+    atomic_store_explicit(&g_iHistoryStatsCount, g_iHistoryWindowCount, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_historyStatsSeq, 1, memory_order_release);
+}
+
+/**
+* @brief Append a core temperature sample to the history and update the window statistics
+*/
+static void recordHistorySample(int64_t milliCelsius)
+{
+    uint64_t seq = atomic_load_explicit(&g_historyHead, memory_order_relaxed);
+    unsigned int gen = atomic_load_explicit(&g_historyConfigGen, memory_order_acquire);
+    int64_t now = monotonicMs();
+
+    if( gen != g_uHistoryAppliedGen )
+        applyHistoryWindows(gen);
+
+    /* windows are updated before the slot is reused, as they still need the old sample */
+    for( int i = 0; i < g_iHistoryWindowCount; i++ )
+        addHistorySample(&g_historyWindows[i], seq, now, (int)milliCelsius);
+
+    atomic_store_explicit(&g_history[seq & TEMP_HISTORY_MASK], PACK_SAMPLE(now, milliCelsius), memory_order_relaxed);
+    atomic_store_explicit(&g_historyHead, seq + 1, memory_order_release);
+    publishHistoryStats(now);
+}
+
+static void sampleSensors(void)
+{
+    int64_t readings[MAX_THERMAL_SENSORS];
+
+    readAllSensors(readings);
+    publishReadings(readings);
+    if( g_iCoreSensor != -1 && readings[g_iCoreSensor] != TEMP_INVALID )
+        recordHistorySample(readings[g_iCoreSensor]);
+    notifyTempState(readings);
+}
+
+/**
+* @brief Open a kernel uevent socket so thermal trip point events trigger an early sample
+*
+* @return fd, or -1 if uevents are not available; the sampler then relies on its timer
+*/
+static int openThermalUeventSocket(void)
+{
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = 1 };
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+
+    if( fd == -1 )
+        return -1;
+    if( bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 )
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+* @brief Drain the uevent socket
+*
+* @return 1 if a thermal subsystem event was received, 0 otherwise
+*/
+static int readThermalUevents(int fd)
+{
+    char buf[2048];
+    ssize_t len;
+    int thermal = 0;
+
+    /* each event is a list of NUL separated KEY=value fields */
+    while( (len = recv(fd, buf, sizeof(buf) - 1, 0)) > 0 )
+    {
+        buf[len] = '\0';
+        for( char *field = buf; field < buf + len; field += strlen(field) + 1 )
+        {
+            if( strcmp(field, "SUBSYSTEM=thermal") == 0 )
+                thermal = 1;
+        }
+    }
+    return thermal;
+}
+
+static void *tempSamplerThread(void *arg)
+{
+    struct pollfd fds[3] = {
+        { .fd = g_samplerTimerFd, .events = POLLIN },
+        { .fd = g_samplerStopFd, .events = POLLIN },
+        { .fd = g_samplerUeventFd, .events = POLLIN },
+    };
+    uint64_t expirations;
+
+    (void)arg;
+    /* the stop flag is seen within one timer period even if the stop event is lost */
+    while( !t_samplerDetached && !atomic_load_explicit(&g_samplerStop, memory_order_acquire) )
+    {
+        if( poll(fds, 3, -1) == -1 )
+            continue;
+        if( fds[1].revents || atomic_load_explicit(&g_samplerStop, memory_order_acquire) )
+            break;
+        if( fds[0].revents & POLLIN )
+        {
+            if( read(fds[0].fd, &expirations, sizeof(expirations)) == sizeof(expirations) )
+                sampleSensors();
+        }
+        if( !t_samplerDetached && (fds[2].revents & POLLIN) && readThermalUevents(fds[2].fd) )
+            sampleSensors();
+    }
+    /* stopped from a listener; nobody joins this thread, so its fds are closed here */
+    if( t_samplerDetached )
+    {
+        for( int i = 0; i < 3; i++ )
+        {
+            if( fds[i].fd != -1 )
+                close(fds[i].fd);
+        }
+    }
+    return NULL;
+}
 
 /**
 * @brief get current temperature of the core
@@ -29,38 +723,92 @@ static int g_iTempThresholdCritical = 75;
 * @param [out] curState:  the current state of the core temperature
 * @param [out] temperatureValue:  raw temperature value of the core
 *              in degrees Celsius
-* @param [out] wifiTemp: temperature value of wifi chipset
+* @param [out] wifiTemp: temperature value of wifi chipset; 0 when the board
+*              has no Wi-Fi temperature sensor
 *
 * @return Error Code
 */
-mfrError_t mfrGetTemperature(mfrTemperatureState_t *curState, int *temperatureValue, int *wifiTemp)
+static mfrError_t getTemperature(mfrTemperatureState_t *curState, int *temperatureValue, int *wifiTemp, int *cacheHit)
 {
     if ( curState == NULL || temperatureValue == NULL || wifiTemp == NULL )
         return mfrERR_INVALID_PARAM;
 
     int value = 0;
+    int64_t readings[MAX_THERMAL_SENSORS];
     mfrTemperatureState_t state = mfrTEMPERATURE_NORMAL;
+    uint64_t thresholds = atomic_load_explicit(&g_tempThresholds, memory_order_relaxed);
 
-    FILE* fp = fopen("/sys/class/thermal/thermal_zone0/temp", "r");
-    if( fp != NULL )
-    {
-        fscanf (fp, "%d", &value);
-        fclose(fp);
-    }
+    pthread_once(&g_discoverOnce, discoverSensors);
+    if( g_iCoreSensor == -1 )
+        return mfrERR_TEMP_READ_FAILED;
 
-    value /= 1000;
+    *cacheHit = getReadings(readings);
+    if( readings[g_iCoreSensor] == TEMP_INVALID )
+        return mfrERR_TEMP_READ_FAILED;
 
-    if( value >= g_iTempThresholdHigh )
+    value = (int)(readings[g_iCoreSensor] / 1000);
+
+    if( value >= THRESHOLD_HIGH(thresholds) )
         state = mfrTEMPERATURE_HIGH;
-    if( value >= g_iTempThresholdCritical )
+    if( value >= THRESHOLD_CRITICAL(thresholds) )
         state = mfrTEMPERATURE_CRITICAL;
 
     *curState = state;
     *temperatureValue = value;
+    *wifiTemp = 0;
+    if( g_iWifiSensor != -1 && readings[g_iWifiSensor] != TEMP_INVALID )
+        *wifiTemp = (int)(readings[g_iWifiSensor] / 1000);
 
     return mfrERR_NONE;
 }
 
+mfrError_t mfrGetTemperature(mfrTemperatureState_t *curState, int *temperatureValue, int *wifiTemp)
+{
+    uint64_t start = statsNow();
+    int cacheHit = 0;
+    mfrError_t ret = getTemperature(curState, temperatureValue, wifiTemp, &cacheHit);
+
+    statsRecordApi(mfrSTATS_API_GET_TEMPERATURE, start, ret, cacheHit);
+    return ret;
+}
+
+static mfrError_t getTemperatureZones(mfrThermalZone_t *zones, int maxZones, int *zoneCount, int *cacheHit)
+{
+    int64_t readings[MAX_THERMAL_SENSORS];
+    int count;
+
+    if( zones == NULL || zoneCount == NULL || maxZones <= 0 )
+        return mfrERR_INVALID_PARAM;
+
+    pthread_once(&g_discoverOnce, discoverSensors);
+    if( g_iSensorCount == 0 )
+        return mfrERR_TEMP_READ_FAILED;
+
+    *cacheHit = getReadings(readings);
+    count = (g_iSensorCount < maxZones) ? g_iSensorCount : maxZones;
+    for( int i = 0; i < count; i++ )
+    {
+        snprintf(zones[i].name, sizeof(zones[i].name), "%.*s", (int)sizeof(zones[i].name) - 1, g_sensors[i].name);
+        zones[i].valid = (readings[i] != TEMP_INVALID);
+        zones[i].milliCelsius = zones[i].valid ? (int)readings[i] : 0;
+        zones[i].isCore = (i == g_iCoreSensor);
+        zones[i].isWifi = (i == g_iWifiSensor);
+    }
+    *zoneCount = count;
+
+    return mfrERR_NONE;
+}
+
+mfrError_t mfrGetTemperatureZones(mfrThermalZone_t *zones, int maxZones, int *zoneCount)
+{
+    uint64_t start = statsNow();
+    int cacheHit = 0;
+    mfrError_t ret = getTemperatureZones(zones, maxZones, zoneCount, &cacheHit);
+
+    statsRecordApi(mfrSTATS_API_GET_TEMPERATURE_ZONES, start, ret, cacheHit);
+    return ret;
+}
+
 /**
 * @brief Set temperature thresholds which will determine the state returned
 <200b><200b>*        from a call to mfrGetTemperature
@@ -74,9 +822,11 @@ mfrError_t mfrGetTemperature(mfrTemperatureState_t *curState, int *temperatureVa
 */
 mfrError_t mfrSetTempThresholds(int tempHigh, int tempCritical)
 {
-    g_iTempThresholdHigh     = tempHigh;
-    g_iTempThresholdCritical = tempCritical;
+    uint64_t start = statsNow();
+
+    atomic_store_explicit(&g_tempThresholds, PACK_THRESHOLDS(tempHigh, tempCritical), memory_order_relaxed);
 
+    statsRecordApi(mfrSTATS_API_SET_TEMP_THRESHOLDS, start, mfrERR_NONE, 0);
     return mfrERR_NONE;
 }
 
@@ -94,11 +844,269 @@ mfrError_t mfrSetTempThresholds(int tempHigh, int tempCritical)
 */
 mfrError_t mfrGetTempThresholds(int *tempHigh, int *tempCritical)
 {
+    uint64_t start = statsNow();
+
     if( tempHigh == NULL || tempCritical == NULL )
+    {
+        statsRecordApi(mfrSTATS_API_GET_TEMP_THRESHOLDS, start, mfrERR_INVALID_PARAM, 0);
+        return mfrERR_INVALID_PARAM;
+    }
+
+    uint64_t thresholds = atomic_load_explicit(&g_tempThresholds, memory_order_relaxed);
+
+    *tempHigh     = THRESHOLD_HIGH(thresholds);
+    *tempCritical = THRESHOLD_CRITICAL(thresholds);
+
+    statsRecordApi(mfrSTATS_API_GET_TEMP_THRESHOLDS, start, mfrERR_NONE, 0);
+    return mfrERR_NONE;
+}
+
+mfrError_t mfrStartTempSampler(unsigned int intervalMs)
+{
+    struct itimerspec its = {0};
+
+    if( intervalMs == 0 )
+        return mfrERR_INVALID_PARAM;
+
+    pthread_once(&g_discoverOnce, discoverSensors);
+
+    pthread_mutex_lock(&g_samplerLock);
+    if( atomic_load_explicit(&g_samplerRunning, memory_order_relaxed) )
+    {
+        pthread_mutex_unlock(&g_samplerLock);
+        return mfrERR_ALREADY_INITIALIZED;
+    }
+
+    g_samplerTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    g_samplerStopFd = eventfd(0, EFD_CLOEXEC);
+    if( g_samplerTimerFd == -1 || g_samplerStopFd == -1 )
+        goto fail;
+
+    /* first sample right away, then every intervalMs */
+    its.it_value.tv_nsec = 1;
+    its.it_interval.tv_sec = intervalMs / 1000;
+    its.it_interval.tv_nsec = (long)(intervalMs % 1000) * 1000000L;
+    if( timerfd_settime(g_samplerTimerFd, 0, &its, NULL) == -1 )
+        goto fail;
+
+    /* optional; trip point uevents only shorten the reaction time */
+    g_samplerUeventFd = openThermalUeventSocket();
+
+    for( int i = 0; i < g_iSensorCount; i++ )
+        atomic_store_explicit(&g_readings[i], TEMP_INVALID, memory_order_relaxed);
+
+    /* listeners are told about the state seen by this sampler run, not a stale one */
+    pthread_mutex_lock(&g_notifyLock);
+    for( int i = 0; i < g_iListenerCount; i++ )
+        g_listeners[i].state = mfrTEMPERATURE_NORMAL;
+    pthread_mutex_unlock(&g_notifyLock);
+
+    atomic_store_explicit(&g_samplerStop, 0, memory_order_relaxed);
+    if( pthread_create(&g_samplerThread, NULL, tempSamplerThread, NULL) != 0 )
+        goto fail;
+
+    atomic_store_explicit(&g_samplerRunning, 1, memory_order_release);
+    pthread_mutex_unlock(&g_samplerLock);
+    return mfrERR_NONE;
+
+fail:
+    if( g_samplerTimerFd != -1 )
+        close(g_samplerTimerFd);
+    if( g_samplerStopFd != -1 )
+        close(g_samplerStopFd);
+    if( g_samplerUeventFd != -1 )
+        close(g_samplerUeventFd);
+    g_samplerTimerFd = g_samplerStopFd = g_samplerUeventFd = -1;
+    pthread_mutex_unlock(&g_samplerLock);
+    return mfrERR_GENERAL;
+}
+
+mfrError_t mfrStopTempSampler(void)
+{
+    uint64_t one = 1;
+    ssize_t written;
+    int self = atomic_load_explicit(&g_samplerRunning, memory_order_acquire) &&
+               pthread_equal(pthread_self(), g_samplerThread);
+
+    if( self )
+    {
+        /* called from a listener on the sampler thread, which cannot join itself. The lock may
+         * be held by a thread that is stopping the sampler and waits for this callback to end. */
+        while( pthread_mutex_trylock(&g_samplerLock) != 0 )
+        {
+            if( atomic_load_explicit(&g_samplerStop, memory_order_acquire) )
+                return mfrERR_NONE;
+            sched_yield();
+        }
+        if( !atomic_load_explicit(&g_samplerRunning, memory_order_relaxed) )
+        {
+            pthread_mutex_unlock(&g_samplerLock);
+            return mfrERR_NOT_INITIALIZED;
+        }
+        atomic_store_explicit(&g_samplerRunning, 0, memory_order_release);
+        t_samplerDetached = 1;
+        pthread_detach(g_samplerThread);
+        g_samplerTimerFd = g_samplerStopFd = g_samplerUeventFd = -1;
+        pthread_mutex_unlock(&g_samplerLock);
+        return mfrERR_NONE;
+    }
+
+    pthread_mutex_lock(&g_samplerLock);
+    if( !atomic_load_explicit(&g_samplerRunning, memory_order_relaxed) )
+    {
+        pthread_mutex_unlock(&g_samplerLock);
+        return mfrERR_NOT_INITIALIZED;
+    }
+
+    /* readers fall back to direct reads from here on */
+    atomic_store_explicit(&g_samplerRunning, 0, memory_order_release);
+    atomic_store_explicit(&g_samplerStop, 1, memory_order_release);
+    /* a lost stop event only delays the exit until the next timer tick sees the flag */
+    written = write(g_samplerStopFd, &one, sizeof(one));
+    (void)written;
+    pthread_join(g_samplerThread, NULL);
+
+    close(g_samplerTimerFd);
+    close(g_samplerStopFd);
+    if( g_samplerUeventFd != -1 )
+        close(g_samplerUeventFd);
+    g_samplerTimerFd = g_samplerStopFd = g_samplerUeventFd = -1;
+    pthread_mutex_unlock(&g_samplerLock);
+    return mfrERR_NONE;
+}
+
+mfrError_t mfrRegisterTempStateNotify(mfrTempStateNotify_t cb, void *cbData, int tempHigh, int tempCritical, int hysteresis)
+{
+    mfrError_t ret;
+
+    if( cb == NULL || tempHigh > tempCritical || hysteresis < 0 )
+        return mfrERR_INVALID_PARAM;
+
+    pthread_mutex_lock(&g_notifyLock);
+    if( g_iListenerCount >= MAX_TEMP_NOTIFY )
+    {
+        pthread_mutex_unlock(&g_notifyLock);
+        return mfrERR_MEMORY_EXHAUSTED;
+    }
+    g_listeners[g_iListenerCount].cb = cb;
+    g_listeners[g_iListenerCount].cbData = cbData;
+    g_listeners[g_iListenerCount].thresholds = PACK_THRESHOLDS(tempHigh, tempCritical);
+    g_listeners[g_iListenerCount].hysteresis = hysteresis;
+    g_listeners[g_iListenerCount].state = mfrTEMPERATURE_NORMAL;
+    g_iListenerCount++;
+    pthread_mutex_unlock(&g_notifyLock);
+
+    /* transitions are detected by the sampler; keep its interval if it already runs */
+    ret = mfrStartTempSampler(DEFAULT_SAMPLER_INTERVAL_MS);
+    if( ret == mfrERR_ALREADY_INITIALIZED )
+        ret = mfrERR_NONE;
+    if( ret != mfrERR_NONE )
+        mfrUnregisterTempStateNotify(cb, cbData);
+
+    return ret;
+}
+
+mfrError_t mfrUnregisterTempStateNotify(mfrTempStateNotify_t cb, void *cbData)
+{
+    mfrError_t ret = mfrERR_INVALID_PARAM;
+
+    pthread_mutex_lock(&g_notifyLock);
+    for( int i = 0; i < g_iListenerCount; i++ )
+    {
+        if( g_listeners[i].cb == cb && g_listeners[i].cbData == cbData )
+        {
+            g_listeners[i] = g_listeners[--g_iListenerCount];
+            ret = mfrERR_NONE;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_notifyLock);
+
+    return ret;
+}
+
+mfrError_t mfrGetTempHistory(mfrTempSample_t *samples, int maxSamples, int *sampleCount)
+{
+    uint64_t head;
+    uint64_t start;
+
+    if( samples == NULL || maxSamples <= 0 || sampleCount == NULL )
         return mfrERR_INVALID_PARAM;
 
-    *tempHigh     = g_iTempThresholdHigh;
-    *tempCritical = g_iTempThresholdCritical;
+    for( ;; )
+    {
+        head = atomic_load_explicit(&g_historyHead, memory_order_acquire);
+        start = (head > TEMP_HISTORY_SIZE) ? head - TEMP_HISTORY_SIZE : 0;
+        if( head - start > (uint64_t)maxSamples )
+            start = head - (uint64_t)maxSamples;
+
+        for( uint64_t seq = start; seq < head; seq++ )
+        {
+            uint64_t packed = atomic_load_explicit(&g_history[seq & TEMP_HISTORY_MASK], memory_order_relaxed);
+            samples[seq - start].timestampMs = (unsigned long long)SAMPLE_TIME(packed);
+            samples[seq - start].milliCelsius = SAMPLE_VALUE(packed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+
+        /* retry if the sampler reused a slot while it was copied */
+        if( atomic_load_explicit(&g_historyHead, memory_order_relaxed) - start <= TEMP_HISTORY_SIZE )
+            break;
+    }
+
+    *sampleCount = (int)(head - start);
+    return mfrERR_NONE;
+}
+
+mfrError_t mfrGetTempHistoryStats(mfrTempHistoryStats_t *stats, int maxWindows, int *windowCount)
+{
+    unsigned int seq;
+    int count;
+
+    if( stats == NULL || maxWindows <= 0 || windowCount == NULL )
+        return mfrERR_INVALID_PARAM;
+
+    do
+    {
+        seq = atomic_load_explicit(&g_historyStatsSeq, memory_order_acquire);
+        count = atomic_load_explicit(&g_iHistoryStatsCount, memory_order_relaxed);
+        if( count > maxWindows )
+            count = maxWindows;
+        for( int i = 0; i < count; i++ )
+        {
+            _Atomic int64_t *published = g_historyStats[i];
+            stats[i].windowSec = (unsigned int)atomic_load_explicit(&published[STAT_WINDOW_SEC], memory_order_relaxed);
+            stats[i].samples = (int)atomic_load_explicit(&published[STAT_SAMPLES], memory_order_relaxed);
+            stats[i].minMilliCelsius = (int)atomic_load_explicit(&published[STAT_MIN], memory_order_relaxed);
+            stats[i].maxMilliCelsius = (int)atomic_load_explicit(&published[STAT_MAX], memory_order_relaxed);
+            stats[i].meanMilliCelsius = (int)atomic_load_explicit(&published[STAT_MEAN], memory_order_relaxed);
+            stats[i].milliCelsiusPerMinute = (int)atomic_load_explicit(&published[STAT_RATE], memory_order_relaxed);
+            stats[i].spanMs = (unsigned int)atomic_load_explicit(&published[STAT_SPAN], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+    } while( (seq & 1) || seq != atomic_load_explicit(&g_historyStatsSeq, memory_order_relaxed) );
+
+    if( count == 0 )
+        return mfrERR_NOT_INITIALIZED;
+
+    *windowCount = count;
+    return mfrERR_NONE;
+}
+
+mfrError_t mfrSetTempHistoryWindows(const unsigned int *windowSec, int count)
+{
+    if( windowSec == NULL || count <= 0 || count > MFR_TEMP_HISTORY_MAX_WINDOWS )
+        return mfrERR_INVALID_PARAM;
+    for( int i = 0; i < count; i++ )
+    {
+        if( windowSec[i] == 0 )
+            return mfrERR_INVALID_PARAM;
+    }
+
+    pthread_mutex_lock(&g_historyLock);
+    memcpy(g_historyWindowSec, windowSec, sizeof(unsigned int) * count);
+    g_iHistoryConfigCount = count;
+    atomic_fetch_add_explicit(&g_historyConfigGen, 1, memory_order_release);
+    pthread_mutex_unlock(&g_historyLock);
 
     return mfrERR_NONE;
 }